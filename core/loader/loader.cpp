@@ -0,0 +1,47 @@
+#include "loader.hpp"
+#include <algorithm>
+
+AssetLoader::AssetLoader(int threads) : quit(false) {
+    int count = threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < count; i++) {
+        workers.emplace_back(&AssetLoader::Worker, this);
+    }
+}
+
+AssetLoader::~AssetLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        jobs.clear();  // destroying the tasks breaks their promises, nobody waits forever
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int AssetLoader::ThreadCount() const {
+    return (int)workers.size();
+}
+
+int AssetLoader::QueuedCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)jobs.size();
+}
+
+void AssetLoader::Worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return quit || !jobs.empty(); });
+        if (quit) {
+            return;
+        }
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+
+        // Loading runs unlocked, the other workers pick the next jobs meanwhile
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
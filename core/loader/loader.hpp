@@ -0,0 +1,57 @@
+#if !defined(LOADER_HPP)
+#define LOADER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background loading of assets (meshes, textures, sounds) on a pool of worker threads.
+// Jobs start in submission order and hand their result back through a std::future: the thread that owns
+// the asset polls it with IsReady() and installs the result itself, nothing is modified behind its back.
+class AssetLoader {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;    // waiting for a worker, oldest first
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit;
+
+    void Worker();
+
+public:
+    AssetLoader(int threads = 0);  // 0 => one thread per hardware core
+    ~AssetLoader();                // jobs not started yet are dropped, their futures report a broken promise
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // Queues job() for a worker thread, its return value (or exception) arrives through the future
+    template<class Job>
+    auto Submit(Job job) -> std::future<decltype(job())> {
+        typedef decltype(job()) Result;
+        std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.emplace_back([task]() { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    int ThreadCount() const;
+    int QueuedCount();             // jobs no worker has started yet
+
+    // Non-blocking check, false for a future that was already consumed
+    template<class T>
+    static bool IsReady(const std::future<T>& result) {
+        return result.valid() && result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+};
+
+#endif // LOADER_HPP
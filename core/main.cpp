@@ -5,10 +5,14 @@
 #include "clock/clock.hpp"
 #include "sound/sound.hpp"
 #include "render/render.hpp"
+#include "loader/loader.hpp"
 
 // Shared exit flag
 static volatile bool g_shouldExit = false;
 
+// Shared worker pool loading meshes, textures and sounds for the other threads
+static AssetLoader g_assetLoader;
+
 // Thread procedures
 DWORD WINAPI ConsoleThreadProc(LPVOID lpParam) {
     volatile bool* g_shouldExit = static_cast<volatile bool*>(lpParam);
@@ -114,9 +118,12 @@ DWORD WINAPI SoundThreadProc(LPVOID lpParam) {
         return 1;
     }
 
-    sound.LoadWavFile("ahem_x.wav");
-    sound.LoadWavFile("air_raid.wav");
-    sound.LoadWavFile("airplane.wav");
+    // Decoded side by side in the background, a key pressed before its sound arrived loads it on the spot
+    std::future<bool> wavLoads[] = {
+        g_assetLoader.Submit([&sound]() { return sound.LoadWavFile("ahem_x.wav"); }),
+        g_assetLoader.Submit([&sound]() { return sound.LoadWavFile("air_raid.wav"); }),
+        g_assetLoader.Submit([&sound]() { return sound.LoadWavFile("airplane.wav"); })
+    };
 
     while (!*g_shouldExit) {
         if (input.GetKeyMSB(VK_ESCAPE)) {
@@ -137,6 +144,9 @@ DWORD WINAPI SoundThreadProc(LPVOID lpParam) {
         }   
         Sleep(10); // Polling interval
     }
+    for (std::future<bool>& load : wavLoads) {
+        if (load.valid()) load.wait(); // no load may outlive the audio system
+    }
     sound.SoundWavKillAll();
     sound.AudioShutdown();
     
@@ -150,16 +160,23 @@ DWORD WINAPI RenderThreadProc(LPVOID lpParam) {
     ClockManager clock;
     SimpleRenderer renderer(console);  // Pass by reference instead of pointer
     
-    // Try to load the african head model
-    std::string modelPath = "core/tinyrenderer-master/obj/african_head/african_head.obj";
-    if (!renderer.LoadModel(modelPath)) {
-        console.PrintColoredLine(COLOR_BRIGHT_RED, "Failed to load 3D model!");
-        *g_shouldExit = true;
-        return 1;
-    }
+    // Scene: three assets side by side, boggie is made of three meshes sharing one transform.
+    // Every mesh and texture loads in the background: frames start at once, the meshes show up as they arrive
+    std::string objPath = "core/tinyrenderer-master/obj/";
+    mat<4,4> left  = Scene::Transform({-0.9, 0, 0}, 0.45);
+    mat<4,4> mid   = Scene::Transform({ 0.0, 0, 0}, 0.45);
+    mat<4,4> right = Scene::Transform({ 0.9, 0, 0}, 0.45);
+    renderer.RequestModelInstance(objPath + "african_head/african_head.obj", left, g_assetLoader);
+    renderer.RequestModelInstance(objPath + "boggie/body.obj", mid, g_assetLoader);
+    renderer.RequestModelInstance(objPath + "boggie/head.obj", mid, g_assetLoader);
+    renderer.RequestModelInstance(objPath + "boggie/eyes.obj", mid, g_assetLoader);
+    renderer.RequestModelInstance(objPath + "diablo3_pose/diablo3_pose.obj", right, g_assetLoader);
     
-    console.PrintColoredLine(COLOR_BRIGHT_GREEN, "3D renderer started! Model loaded successfully.");
+    console.PrintColoredLine(COLOR_BRIGHT_GREEN, "3D renderer started! Models are loading in the background.");
     console.PrintColoredLine(COLOR_BRIGHT_YELLOW, "Press 1=4bit, 2=8bit, 3=24bit colors");
+    console.PrintColoredLine(COLOR_BRIGHT_YELLOW, "Press 4=reference, 5=edge-function rasterizer");
+    console.PrintColoredLine(COLOR_BRIGHT_YELLOW, "Press F1=flat, F2=gouraud, F3=textured, F4=textured+lit shading (6-9 play sounds)");
+    console.PrintColoredLine(COLOR_BRIGHT_YELLOW, "Press F5=off, F6=ordered, F7=error diffusion dithering (4/8bit)");
     
     InputManager input;
     
@@ -179,11 +196,52 @@ DWORD WINAPI RenderThreadProc(LPVOID lpParam) {
             renderer.SetColorMode(ColorMode::COLOR_24BIT);
             console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to 24-bit color mode (truecolor)");
         }
+        if (input.GetKeyMSB('4')) {
+            renderer.SetReferenceRasterizer(true);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to reference rasterizer (per-pixel inversion)");
+        }
+        if (input.GetKeyMSB('5')) {
+            renderer.SetReferenceRasterizer(false);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to edge-function rasterizer");
+        }
+        if (input.GetKeyMSB(VK_F1)) {
+            renderer.SetShadingMode(ShadingMode::FLAT);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to flat shading");
+        }
+        if (input.GetKeyMSB(VK_F2)) {
+            renderer.SetShadingMode(ShadingMode::GOURAUD);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to Gouraud shading");
+        }
+        if (input.GetKeyMSB(VK_F3)) {
+            renderer.SetShadingMode(ShadingMode::TEXTURED);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to textured shading");
+        }
+        if (input.GetKeyMSB(VK_F4)) {
+            renderer.SetShadingMode(ShadingMode::TEXTURED_LIT);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to textured + lit shading");
+        }
+        if (input.GetKeyMSB(VK_F5)) {
+            renderer.SetDitherMode(DitherMode::NONE);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Dithering off");
+        }
+        if (input.GetKeyMSB(VK_F6)) {
+            renderer.SetDitherMode(DitherMode::ORDERED);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to ordered dithering (Bayer 4x4)");
+        }
+        if (input.GetKeyMSB(VK_F7)) {
+            renderer.SetDitherMode(DitherMode::ERROR_DIFFUSION);
+            console.PrintColoredLine(COLOR_BRIGHT_CYAN, "Switched to error diffusion dithering (Sierra Lite)");
+        }
         
         //if (clock.SyncClock(renderClock)) {
             console.MoveCursor(1, 1);
             renderer.RenderFrame();
         //}
+        if (renderer.GetScene().FailedCount() > 0) {
+            console.PrintColoredLine(COLOR_BRIGHT_RED, "Failed to load 3D model!");
+            *g_shouldExit = true;
+            return 1;
+        }
         // Sleep(10); // Small sleep to prevent busy waiting
     }
     
@@ -0,0 +1,49 @@
+#include "ansi.hpp"
+#include <cstdio>
+
+template<class T>
+static AnsiSequence MakeSequence(const char* format, T value) {
+    AnsiSequence sequence = {};
+    sequence.size = (std::uint8_t)std::snprintf(sequence.bytes, sizeof(sequence.bytes), format, value);
+    return sequence;
+}
+
+AnsiTables::AnsiTables() {
+    for (int bg = 0; bg < 2; bg++) {
+        // 30-37 and 90-97 for the foreground, 40-47 and 100-107 for the background
+        for (int i = 0; i < 16; i++) {
+            palette16[bg][i] = MakeSequence("\033[%dm", (i < 8 ? 30 + i : 90 + i - 8) + 10 * bg);
+        }
+        for (int i = 0; i < 256; i++) {
+            palette256[bg][i] = MakeSequence(bg ? "\033[48;5;%dm" : "\033[38;5;%dm", i);
+        }
+        truecolor[bg] = MakeSequence("%s", bg ? "\033[48;2" : "\033[38;2");
+        defaultColor[bg] = MakeSequence("\033[%dm", bg ? 49 : 39);
+    }
+    for (int i = 0; i < 256; i++) {
+        decimal[i] = MakeSequence(";%d", i);
+    }
+}
+
+const AnsiTables& AnsiTables::Get() {
+    static const AnsiTables tables;
+    return tables;
+}
+
+char* AnsiBuffer::grow(std::size_t count) {
+    if (used + count + Slack > capacity) {
+        std::size_t newCapacity = capacity * 2 > used + count + Slack ? capacity * 2 : used + count + Slack;
+        std::unique_ptr<char[]> newBytes(new char[newCapacity]);
+        if (used > 0) {
+            std::memcpy(newBytes.get(), bytes.get(), used);
+        }
+        bytes = std::move(newBytes);
+        capacity = newCapacity;
+    }
+    return bytes.get() + used;
+}
+
+const char* AnsiBuffer::c_str() {
+    *grow(1) = '\0';
+    return bytes.get();
+}
@@ -0,0 +1,64 @@
+#if !defined(ANSI_HPP)
+#define ANSI_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Escape sequence stored with its length: written with one fixed-size copy of the whole array,
+// the bytes past size are overwritten by the next write
+struct AnsiSequence {
+    char bytes[15];
+    std::uint8_t size;
+};
+
+// Every color escape the renderer emits, built once
+struct AnsiTables {
+    AnsiSequence palette16[2][16];    // [background][0-7 normal, 8-15 bright]: \033[30m ... \033[107m
+    AnsiSequence palette256[2][256];  // [background][code]: \033[38;5;<n>m, \033[48;5;<n>m
+    AnsiSequence truecolor[2];        // [background]: \033[38;2 and \033[48;2, three decimals and 'm' follow
+    AnsiSequence decimal[256];        // ;0 ... ;255
+    AnsiSequence defaultColor[2];     // [background]: \033[39m and \033[49m
+
+    AnsiTables();
+    static const AnsiTables& Get();
+};
+
+inline char* AnsiWrite(char* out, const AnsiSequence& sequence) {
+    std::memcpy(out, sequence.bytes, sizeof(sequence.bytes));
+    return out + sequence.size;
+}
+
+// Parameters of the sequence appended to the escape that ends just before out: "\033[38;5;9m" + "\033[48;5;4m" gives "\033[38;5;9;48;5;4m"
+inline char* AnsiWriteContinued(char* out, const AnsiSequence& sequence) {
+    out[-1] = ';';
+    std::memcpy(out, sequence.bytes + 2, sizeof(sequence.bytes) - 2);
+    return out + sequence.size - 2;
+}
+
+// Bytes of a frame. Room for a batch of writes is made once with grow(), the writes then go through
+// a plain pointer without any size check, and commit() takes their end
+class AnsiBuffer {
+private:
+    std::unique_ptr<char[]> bytes;
+    std::size_t used = 0;
+    std::size_t capacity = 0;
+
+public:
+    static const std::size_t Slack = sizeof(AnsiSequence::bytes); // an AnsiWrite() copies more than it keeps
+
+    char* grow(std::size_t count);    // room for count more bytes, returns the end of the buffer
+    void commit(char* end) { used = end - bytes.get(); }
+
+    void clear() { used = 0; }        // keeps the memory
+    std::size_t size() const { return used; }
+    const char* data() const { return bytes.get(); }
+    const char* c_str();              // null terminated
+
+    void append(const char* text, std::size_t count) { commit((char*)std::memcpy(grow(count), text, count) + count); }
+    AnsiBuffer& operator+=(const char* text) { append(text, std::strlen(text)); return *this; }
+    AnsiBuffer& operator+=(char c) { *grow(1) = c; used++; return *this; }
+};
+
+#endif // ANSI_HPP
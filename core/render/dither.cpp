@@ -0,0 +1,100 @@
+#include "dither.hpp"
+#include <algorithm>
+#include <cmath>
+
+// 4x4 Bayer matrix: thresholds 0-15 spread so that every 2x2 and 4x4 block covers the range evenly
+static const int Bayer4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+static float Distance(const std::uint8_t* rgb, int r, int g, int b) {
+    float dr = float(r - rgb[0]), dg = float(g - rgb[1]), db = float(b - rgb[2]);
+    return std::sqrt(dr * dr + dg * dg + db * db);
+}
+
+int DitherQuantizer::Quantize(int r, int g, int b, int previous) const {
+    int nearest = colors == 16 ? palette.Nearest16(r, g, b) : palette.Nearest256(r, g, b);
+    if (previous < 0 || previous == nearest || hysteresis <= 0.0f) {
+        return nearest;
+    }
+    return Distance(Rgb(previous), r, g, b) <= Distance(Rgb(nearest), r, g, b) + hysteresis ? previous : nearest;
+}
+
+static void OrderedDitherScalar(std::uint32_t* pixels, int count, const int* offsets, int x) {
+    for (; x < count; x++) {
+        int offset = offsets[x & 3];
+        std::uint32_t pixel = pixels[x];
+        std::uint32_t dithered = pixel & 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            int c = std::clamp(int(pixel >> shift & 0xFF) + offset, 0, 255);
+            dithered |= std::uint32_t(c) << shift;
+        }
+        pixels[x] = dithered;
+    }
+}
+
+#if defined(SIMD_X86)
+// 4 pixels per iteration, one period of the pattern: the positive offsets are added and the negative ones subtracted, saturated
+static void OrderedDitherSse2(std::uint32_t* pixels, int count, const int* offsets) {
+    alignas(16) std::uint8_t add[16] = {}, sub[16] = {};
+    for (int i = 0; i < 4; i++) {
+        for (int c = 0; c < 3; c++) {
+            add[i * 4 + c] = std::uint8_t(std::max(offsets[i], 0));
+            sub[i * 4 + c] = std::uint8_t(std::max(-offsets[i], 0));
+        }
+    }
+    const __m128i addVector = _mm_load_si128(reinterpret_cast<const __m128i*>(add));
+    const __m128i subVector = _mm_load_si128(reinterpret_cast<const __m128i*>(sub));
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+        v = _mm_subs_epu8(_mm_adds_epu8(v, addVector), subVector);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x), v);
+    }
+    OrderedDitherScalar(pixels, count, offsets, x);
+}
+#endif
+
+void OrderedDitherRow(std::uint32_t* pixels, int count, int row, int amplitude, SimdLevel level) {
+    // Threshold t of 0-15 becomes an offset centered on 0: (t + 0.5) / 16 - 0.5 of the amplitude
+    int offsets[4];
+    for (int i = 0; i < 4; i++) {
+        offsets[i] = (2 * Bayer4[row & 3][i] + 1) * amplitude / 32 - amplitude / 2;
+    }
+#if defined(SIMD_X86)
+    if (level != SimdLevel::SCALAR) {
+        OrderedDitherSse2(pixels, count, offsets);
+        return;
+    }
+#endif
+    OrderedDitherScalar(pixels, count, offsets, 0);
+}
+
+void DiffuseErrorRow(const DitherQuantizer& quantizer, const std::uint32_t* pixels, std::uint8_t* codes, bool stable, int begin, int end,
+                     const std::int16_t* above, std::int16_t* below, int carried[3]) {
+    for (int x = begin; x < end; x++) {
+        // Pixel plus 2/4 of the error on its left and 1/4 of each of the two above it (summed by the row above)
+        std::uint32_t pixel = pixels[x];
+        int color[3];
+        for (int c = 0; c < 3; c++) {
+            int error = 2 * carried[c] + (above ? above[x * 3 + c] : 0);
+            color[c] = std::clamp(int(pixel >> (16 - 8 * c) & 0xFF) + error / 4, 0, 255);  // r, g, b
+        }
+        int code = quantizer.Quantize(color[0], color[1], color[2], stable ? codes[x] : -1);
+        codes[x] = std::uint8_t(code);
+
+        // What the code misses of the color goes on, the cell below left gets its share added to the one of its own pixel
+        const std::uint8_t* rgb = quantizer.Rgb(code);
+        for (int c = 0; c < 3; c++) {
+            int error = color[c] - rgb[c];
+            carried[c] = error;
+            below[x * 3 + c] = std::int16_t(error);
+            if (x > 0) {
+                below[(x - 1) * 3 + c] += std::int16_t(error);
+            }
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#if !defined(DITHER_HPP)
+#define DITHER_HPP
+
+#include "palette.hpp"
+#include "../tinyrenderer-master/simd.h"
+#include <cstdint>
+
+// Dithering of the sampled framebuffer before its quantization to the 16 or 256 colors, one row of cells at a time.
+// Pixels are packed like the framebuffer: b,g,r,a bytes, alpha ignored. Codes are palette indices, one byte per cell.
+
+// Quantization of dithered colors, optionally sticky: with a hysteresis, a cell keeps the code it had in the previous
+// frame as long as that code is at most 'hysteresis' farther from the color than the nearest one (RGB distance).
+// A color halfway between two codes does not flip from one to the other every frame.
+struct DitherQuantizer {
+    const PaletteTables& palette;
+    int colors;        // 16 or 256
+    float hysteresis;  // 0: always the nearest code
+
+    int Quantize(int r, int g, int b, int previous) const;  // previous: the cell's code of the last frame, -1 if none
+    const std::uint8_t* Rgb(int code) const { return colors == 16 ? palette.rgb16[code] : palette.rgb256[code]; }
+};
+
+// Bayer 4x4 thresholds added to a row of pixels, in place and saturated, spread over +-amplitude/2.
+// The pattern is anchored to the cells and never animated: a still surface keeps a still pattern.
+void OrderedDitherRow(std::uint32_t* pixels, int count, int row, int amplitude, SimdLevel level);
+
+// Sierra Lite error diffusion over the cells [begin, end) of a row, left to right:
+//        *  2
+//     1  1      (quarters)
+// 'above' holds the error the row above left for each cell (3 channels, nullptr on the first row), 'below' receives the one
+// of this row for the next. 'carried' is the error passing to the right, zeroed by the caller at the start of the row.
+// Cell x of 'below' is final once the cells x and x+1 of this row are done, which lets the next row follow two cells behind.
+// 'codes' holds the previous frame's codes when stable is set, they are replaced by this frame's.
+void DiffuseErrorRow(const DitherQuantizer& quantizer, const std::uint32_t* pixels, std::uint8_t* codes, bool stable, int begin, int end,
+                     const std::int16_t* above, std::int16_t* below, int carried[3]);
+
+#endif // DITHER_HPP
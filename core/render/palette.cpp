@@ -0,0 +1,85 @@
+#include "palette.hpp"
+#include <cmath>
+
+// sRGB component to OKLab (Björn Ottosson's matrices, linear light first)
+struct OkLab {
+    float L, a, b;
+};
+
+static float LinearComponent(int c) {
+    float v = c / 255.0f;
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static OkLab ToOkLab(int r, int g, int b) {
+    float lr = LinearComponent(r), lg = LinearComponent(g), lb = LinearComponent(b);
+    float l = std::cbrt(0.4122214708f * lr + 0.5363325363f * lg + 0.0514459929f * lb);
+    float m = std::cbrt(0.2119034982f * lr + 0.6806995451f * lg + 0.1073969566f * lb);
+    float s = std::cbrt(0.0883024619f * lr + 0.2817188376f * lg + 0.6299787005f * lb);
+    return {
+        0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+        1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+        0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s
+    };
+}
+
+// Chroma counts twice: the palettes have few dark tints, and with a plain distance a dim colored surface
+// (the blue background, shaded skin) snaps to the gray ramp instead of keeping its hue
+static int NearestEntry(const OkLab& color, const OkLab* entries, int first, int last) {
+    const float chromaWeight = 2.0f;
+    int best = first;
+    float bestDistance = 1e30f;
+    for (int i = first; i <= last; i++) {
+        float dL = color.L - entries[i].L;
+        float da = (color.a - entries[i].a) * chromaWeight;
+        float db = (color.b - entries[i].b) * chromaWeight;
+        float distance = dL * dL + da * da + db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+PaletteTables::PaletteTables() {
+    static const std::uint8_t xterm16[16][3] = {
+        {  0,   0,   0}, {205,   0,   0}, {  0, 205,   0}, {205, 205,   0},
+        {  0,   0, 238}, {205,   0, 205}, {  0, 205, 205}, {229, 229, 229},
+        {127, 127, 127}, {255,   0,   0}, {  0, 255,   0}, {255, 255,   0},
+        { 92,  92, 255}, {255,   0, 255}, {  0, 255, 255}, {255, 255, 255}
+    };
+    static const std::uint8_t cubeLevels[6] = {0, 95, 135, 175, 215, 255};
+
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            rgb16[i][c] = rgb256[i][c] = xterm16[i][c];
+        }
+    }
+    for (int i = 0; i < 216; i++) {
+        rgb256[16 + i][0] = cubeLevels[i / 36];
+        rgb256[16 + i][1] = cubeLevels[i / 6 % 6];
+        rgb256[16 + i][2] = cubeLevels[i % 6];
+    }
+    for (int i = 0; i < 24; i++) {
+        rgb256[232 + i][0] = rgb256[232 + i][1] = rgb256[232 + i][2] = (std::uint8_t)(8 + 10 * i);
+    }
+
+    OkLab entries[256];
+    for (int i = 0; i < 256; i++) {
+        entries[i] = ToOkLab(rgb256[i][0], rgb256[i][1], rgb256[i][2]);
+    }
+
+    // Every 5-bit component expanded to 8 bits so that 0 and 31 map to 0 and 255
+    for (int index = 0; index < 32768; index++) {
+        int r5 = index >> 10, g5 = index >> 5 & 31, b5 = index & 31;
+        OkLab color = ToOkLab(r5 << 3 | r5 >> 2, g5 << 3 | g5 >> 2, b5 << 3 | b5 >> 2);
+        nearest16[index] = (std::uint8_t)NearestEntry(color, entries, 0, 15);
+        nearest256[index] = (std::uint8_t)NearestEntry(color, entries, 16, 255);
+    }
+}
+
+const PaletteTables& PaletteTables::Get() {
+    static const PaletteTables tables;
+    return tables;
+}
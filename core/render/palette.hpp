@@ -0,0 +1,24 @@
+#if !defined(PALETTE_HPP)
+#define PALETTE_HPP
+
+#include <cstdint>
+
+// Nearest palette entry of every RGB555 color for the 4-bit and 8-bit console modes, built once.
+// Nearest in OKLab, where distances follow perceived color differences, against the actual xterm palettes.
+// See NearestEntry() in palette.cpp for the weighting.
+// The 8-bit table only picks codes 16-255: 0-15 are the 16 colors, which terminal themes redefine.
+struct PaletteTables {
+    std::uint8_t rgb16[16][3];      // xterm defaults of the 16 colors (0-7 normal, 8-15 bright)
+    std::uint8_t rgb256[256][3];    // xterm 256 colors: the 16 above, a 6x6x6 cube, 24 grays
+    std::uint8_t nearest16[32768];  // [RGB555] -> 0-15
+    std::uint8_t nearest256[32768]; // [RGB555] -> 16-255
+
+    PaletteTables();
+    static const PaletteTables& Get();
+
+    static int Index(int r, int g, int b) { return (r >> 3) << 10 | (g >> 3) << 5 | b >> 3; }
+    int Nearest16(int r, int g, int b) const { return nearest16[Index(r, g, b)]; }
+    int Nearest256(int r, int g, int b) const { return nearest256[Index(r, g, b)]; }
+};
+
+#endif // PALETTE_HPP
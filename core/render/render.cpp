@@ -1,53 +1,124 @@
 #include "render.hpp"
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 #include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <thread>
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-// External tinyrenderer globals
-extern mat<4,4> ModelView, Perspective;
-extern std::vector<double> zbuffer;
+// Fragment shading specialized at compile time: the raster templates see a final class and inline fragment_batch()
+template<ShadingMode mode>
+struct SimpleShader final : IShader {
+    static constexpr bool textured = (mode == ShadingMode::TEXTURED || mode == ShadingMode::TEXTURED_LIT);
+    static constexpr bool lit      = (mode != ShadingMode::TEXTURED);
 
-struct SimpleShader : IShader {
+    const BasicRenderContext<RenderReal> &ctx; // matrices of the frame
     const Model &model;
-    vec4 l;              // light direction in eye coordinates
-    vec2 varying_uv[3];  // triangle uv coordinates
-    vec4 varying_nrm[3]; // normal per vertex
-    vec4 tri[3];         // triangle in view coordinates
+    const VertexBuffer &clip_verts;  // post-transform vertex cache: every vertex of the model transformed once per frame
+    const VertexBuffer &eye_normals; // by the vertex stage, faces reference them through the model indices
+    vec4 l;                          // light direction in eye coordinates
+    TextureFilter filter;            // diffuse texture sampling
+    int current = 0;                 // face of the last vertex() call, used by the immediate rasterizers
+
+    SimpleShader(const BasicRenderContext<RenderReal> &c, const vec3 light, const Model &m, const VertexBuffer &verts, const VertexBuffer &normals, const TextureFilter f) : ctx(c), model(m), clip_verts(verts), eye_normals(normals), filter(f) {
+        l = normalized(vec_cast<double>(ctx.ModelView * vec<4,RenderReal>{RenderReal(light.x), RenderReal(light.y), RenderReal(light.z), 0}));
+    }
+
+    // Mip level of the diffuse map for a face, from its footprint on the screen
+    double face_lod(const int face) const {
+        if (filter == TextureFilter::NEAREST) return 0.0;
+        vec2 uv[3], screen[3];
+        for (int i = 0; i < 3; i++) {
+            const vec4 clip = clip_verts[model.vert_index(face, i)];
+            if (clip.w <= 0.0) return 0.0; // crosses the camera plane, keep the full resolution
+            uv[i] = model.uv(face, i);
+            screen[i] = { clip.x / clip.w * ctx.Viewport[0][0], clip.y / clip.w * ctx.Viewport[1][1] };
+        }
+        return model.diffuse().lod(uv, screen);
+    }
+
+    TGAColor sample_diffuse(const vec2 &uv, const double lod) const {
+        if (filter == TextureFilter::NEAREST) return model.diffuse().sample(uv);
+        return model.diffuse().sample(uv, lod, filter == TextureFilter::TRILINEAR);
+    }
 
-    SimpleShader(const vec3 light, const Model &m) : model(m) {
-        l = normalized((ModelView * vec4{light.x, light.y, light.z, 0.}));
+    // Ambient + diffuse lighting for a (not necessarily unit) normal
+    double intensity(const vec4 &n) const {
+        double ndotl = (n * l) / norm(n);
+        return 0.3 + (ndotl > 0.0 ? ndotl : 0.0);
     }
 
     virtual vec4 vertex(const int face, const int vert) {
-        varying_uv[vert] = model.uv(face, vert);
-        varying_nrm[vert] = ModelView.invert_transpose() * model.normal(face, vert);
-        vec4 gl_Position = ModelView * model.vert(face, vert);
-        tri[vert] = gl_Position;
-        return Perspective * gl_Position;
+        current = face;
+        return clip_verts[model.vert_index(face, vert)];
     }
 
     virtual std::pair<bool,TGAColor> fragment(const vec3 bar) const {
-        vec2 uv = varying_uv[0] * bar[0] + varying_uv[1] * bar[1] + varying_uv[2] * bar[2];
-        vec4 n = normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]);
-        
-        double ambient = 0.3;
-        double diffuse = (n * l > 0.0) ? n * l : 0.0;
-        
-        TGAColor gl_FragColor = sample2D(model.diffuse(), uv);
-        for (int channel = 0; channel < 3; channel++) {
-            double intensity = static_cast<double>(gl_FragColor[channel]) * (ambient + diffuse);
-            gl_FragColor[channel] = static_cast<uint8_t>((intensity > 255.0) ? 255 : intensity);
+        return fragment(current, bar);
+    }
+
+    virtual std::pair<bool,TGAColor> fragment(const int face, const vec3 bar) const {
+        TGAColor color;
+        fragment_batch(face, 1, &bar, 1, &color);
+        return {false, color};
+    }
+
+    // Structure-of-arrays loops the compiler can vectorize, per-face work is done once per batch
+    virtual int fragment_batch(const int id, const int n, const vec3 bar[], const int mask, TGAColor color[]) const {
+        const int face = id < 0 ? current : id;
+        const vec4 tri_nrm[3] = { eye_normals[model.normal_index(face, 0)], eye_normals[model.normal_index(face, 1)], eye_normals[model.normal_index(face, 2)] };
+        double light[8];
+        if constexpr (mode == ShadingMode::FLAT) {
+            const double face_light = intensity(tri_nrm[0] + tri_nrm[1] + tri_nrm[2]); // one normal for the whole face
+            for (int i = 0; i < n; i++) light[i] = face_light;
+        } else if constexpr (mode == ShadingMode::GOURAUD) {
+            const double vert_light[3] = { intensity(tri_nrm[0]), intensity(tri_nrm[1]), intensity(tri_nrm[2]) }; // lighting at the corners, interpolated
+            for (int i = 0; i < n; i++) light[i] = vert_light[0] * bar[i].x + vert_light[1] * bar[i].y + vert_light[2] * bar[i].z;
+        } else if constexpr (mode == ShadingMode::TEXTURED_LIT) {
+            for (int i = 0; i < n; i++) {
+                double nx = tri_nrm[0].x * bar[i].x + tri_nrm[1].x * bar[i].y + tri_nrm[2].x * bar[i].z;
+                double ny = tri_nrm[0].y * bar[i].x + tri_nrm[1].y * bar[i].y + tri_nrm[2].y * bar[i].z;
+                double nz = tri_nrm[0].z * bar[i].x + tri_nrm[1].z * bar[i].y + tri_nrm[2].z * bar[i].z;
+                double nw = tri_nrm[0].w * bar[i].x + tri_nrm[1].w * bar[i].y + tri_nrm[2].w * bar[i].z;
+                double ndotl = (nx * l.x + ny * l.y + nz * l.z + nw * l.w) / std::sqrt(nx * nx + ny * ny + nz * nz + nw * nw);
+                light[i] = 0.3 + (ndotl > 0.0 ? ndotl : 0.0); // ambient + diffuse, per pixel
+            }
+        }
+
+        double u[8], v[8];
+        double lod = 0.0;
+        if constexpr (textured) {
+            const vec2 tri_uv[3] = { model.uv(face, 0), model.uv(face, 1), model.uv(face, 2) };
+            for (int i = 0; i < n; i++) {
+                u[i] = tri_uv[0].x * bar[i].x + tri_uv[1].x * bar[i].y + tri_uv[2].x * bar[i].z;
+                v[i] = tri_uv[0].y * bar[i].x + tri_uv[1].y * bar[i].y + tri_uv[2].y * bar[i].z;
+            }
+            lod = face_lod(face);
         }
-        gl_FragColor[3] = 255; // Full alpha
-        return {false, gl_FragColor};
+
+        for (int i = 0; i < n; i++) {
+            if (!(mask >> i & 1)) continue;
+            TGAColor gl_FragColor = { 200, 200, 200, 255 }; // untextured surfaces are light gray
+            if constexpr (textured) {
+                if (model.diffuse().levels()) gl_FragColor = sample_diffuse({u[i], v[i]}, lod); // meshes without a diffuse map stay gray
+            }
+            if constexpr (lit) {
+                for (int channel = 0; channel < 3; channel++) {
+                    double value = static_cast<double>(gl_FragColor[channel]) * light[i];
+                    gl_FragColor[channel] = static_cast<uint8_t>((value > 255.0) ? 255 : value);
+                }
+            }
+            gl_FragColor[3] = 255;
+            color[i] = gl_FragColor;
+        }
+        return mask;
     }
 };
 
-SimpleRenderer::SimpleRenderer(ConsoleManager& consoleManager) : console(consoleManager), model(nullptr) {
+SimpleRenderer::SimpleRenderer(ConsoleManager& consoleManager) : console(consoleManager), ansi(AnsiTables::Get()), palette(PaletteTables::Get()) {
     // Initialize console size tracking
     savedConsoleWidth = 0;
     savedConsoleHeight = 0;
@@ -56,26 +127,69 @@ SimpleRenderer::SimpleRenderer(ConsoleManager& consoleManager) : console(console
     
     // Set default color mode to 24-bit
     currentColorMode = ColorMode::COLOR_24BIT;
+    
+    // Use the edge-function rasterizer by default
+    useReferenceRasterizer = false;
+    
+    // One render thread per hardware core
+    renderThreads = 0;
+    threadPool.resize(renderThreads);
+    
+    // Shade visible pixels only
+    useVisibilityBuffer = true;
+    
+    // Skip triangles hidden behind what is already in the z-buffer
+    useOcclusionCulling = true;
+    
+    // Simplify the model when it covers few console cells
+    useLevelOfDetail = true;
+    
+    // Mipmapped diffuse texture
+    textureFilter = TextureFilter::MIPMAP;
+    
+    // Textured and lit surfaces
+    shadingMode = ShadingMode::TEXTURED_LIT;
+    
+    // Model rotation, advanced every frame
+    angle = 0.0f;
+    
+    // Only the cells that changed since the previous frame are sent, once a whole frame is on the terminal
+    useDifferentialOutput = true;
+    screenValid = false;
+    screenColumns = screenRows = 0;
+    frameColumns = frameRows = 0;
+    
+    // Nearest colors until dithering is asked for, patterns kept still once it is
+    ditherMode = DitherMode::NONE;
+    useStableDither = true;
+    ditherCodesValid = false;
+    ditherProgressRows = 0;
 }
 
 SimpleRenderer::~SimpleRenderer() {
-    if (model) {
-        delete model;
-    }
 }
 
 bool SimpleRenderer::LoadModel(const std::string& filename) {
+    scene.Clear();
+    return AddModelInstance(filename, Scene::Transform({0, 0, 0}));
+}
+
+bool SimpleRenderer::AddModelInstance(const std::string& filename, const mat<4,4>& transform) {
     try {
-        if (model) {
-            delete model;
-        }
-        model = new Model(filename);
-        return true;
+        return scene.AddInstance(scene.AddMesh(filename), transform) >= 0;
     } catch (...) {
         return false;
     }
 }
 
+bool SimpleRenderer::RequestModelInstance(const std::string& filename, const mat<4,4>& transform, AssetLoader& loader) {
+    return scene.AddInstance(scene.RequestMesh(filename, loader), transform) >= 0;
+}
+
+Scene& SimpleRenderer::GetScene() {
+    return scene;
+}
+
 void SimpleRenderer::UpdateConsoleSize() {
     // Get current console size
     console.GetConsoleSize(&currentConsoleWidth, &currentConsoleHeight);
@@ -93,116 +207,431 @@ void SimpleRenderer::UpdateConsoleSize() {
 
 // Color mode setter and getter
 void SimpleRenderer::SetColorMode(ColorMode mode) {
+    if (mode != currentColorMode) {
+        ditherCodesValid = false; // codes of another palette
+    }
     currentColorMode = mode;
+    InvalidateOutput(); // same colors, other escapes
 }
 
 ColorMode SimpleRenderer::GetColorMode() const {
     return currentColorMode;
 }
 
-#define MAXV(a,b,c) ( ((a)>(b)) ? ( ((a)>(c)) ? (a) : (c) ) : ( ((b)>(c)) ? (b) : (c) ) )
-#define MINV(a,b,c) ( ((a)<(b)) ? ( ((a)<(c)) ? (a) : (c) ) : ( ((b)<(c)) ? (b) : (c) ) )
-int SimpleRenderer::RGBTo4Bit(int r, int g, int b, bool isBright) {
-    // Normalize once using integer math where possible
-    int maxVal = MAXV(r, g, b);
-    int minVal = MINV(r, g, b);
-    int sum    = r + g + b;
-
-    double brightness = sum / (255.0 * 3.0); // [0,1]
-    bool useBright = isBright || brightness > 0.4;
-
-    double saturation = (maxVal > 0) ? (double)(maxVal - minVal) / maxVal : 0.0;
-
-    // Handle grayscale (low saturation)
-    if (saturation < 0.1) {
-        if (brightness < 0.2) return useBright ? 90 : 30; // Black
-        if (brightness > 0.8) return useBright ? 97 : 37; // White
-        return useBright ? 90 : 30;                       // Mid gray → fallback to black
-    }
-
-    // Color classification
-    int color;
-    if (r >= g && r >= b) {
-        // Red dominant
-        if (g > b && g > r * 0.6)      color = 3; // Yellow
-        else if (b > r * 0.6)          color = 5; // Magenta
-        else                           color = 1; // Red
-    } else if (g >= r && g >= b) {
-        // Green dominant
-        if (r > b && r > g * 0.6)      color = 3; // Yellow
-        else if (b > g * 0.6)          color = 6; // Cyan
-        else                           color = 2; // Green
+// Differential output setter and getter
+void SimpleRenderer::SetDifferentialOutput(bool enabled) {
+    useDifferentialOutput = enabled;
+    InvalidateOutput();
+}
+
+bool SimpleRenderer::IsDifferentialOutput() const {
+    return useDifferentialOutput;
+}
+
+void SimpleRenderer::InvalidateOutput() {
+    screenValid = false;
+}
+
+// Rasterizer setter and getter
+void SimpleRenderer::SetReferenceRasterizer(bool enabled) {
+    useReferenceRasterizer = enabled;
+}
+
+bool SimpleRenderer::IsReferenceRasterizer() const {
+    return useReferenceRasterizer;
+}
+
+// Render thread count setter and getter (0 = one per hardware core)
+void SimpleRenderer::SetRenderThreads(int threads) {
+    renderThreads = MAX(0, threads);
+    threadPool.resize(renderThreads);
+}
+
+int SimpleRenderer::GetRenderThreads() const {
+    return threadPool.size();
+}
+
+// Visibility buffer setter and getter
+void SimpleRenderer::SetVisibilityBuffer(bool enabled) {
+    useVisibilityBuffer = enabled;
+}
+
+bool SimpleRenderer::IsVisibilityBuffer() const {
+    return useVisibilityBuffer;
+}
+
+// Occlusion culling setter and getter
+void SimpleRenderer::SetOcclusionCulling(bool enabled) {
+    useOcclusionCulling = enabled;
+}
+
+bool SimpleRenderer::IsOcclusionCulling() const {
+    return useOcclusionCulling;
+}
+
+// Level of detail setter and getter
+void SimpleRenderer::SetLevelOfDetail(bool enabled) {
+    useLevelOfDetail = enabled;
+}
+
+bool SimpleRenderer::IsLevelOfDetail() const {
+    return useLevelOfDetail;
+}
+
+// Texture filter setter and getter
+void SimpleRenderer::SetTextureFilter(TextureFilter filter) {
+    textureFilter = filter;
+}
+
+TextureFilter SimpleRenderer::GetTextureFilter() const {
+    return textureFilter;
+}
+
+// Shading mode setter and getter
+void SimpleRenderer::SetShadingMode(ShadingMode mode) {
+    shadingMode = mode;
+}
+
+ShadingMode SimpleRenderer::GetShadingMode() const {
+    return shadingMode;
+}
+
+// Dithering setters and getters
+void SimpleRenderer::SetDitherMode(DitherMode mode) {
+    if (mode != ditherMode) {
+        ditherCodesValid = false; // codes of another pattern; setting the same mode again keeps them
+    }
+    ditherMode = mode;
+}
+
+DitherMode SimpleRenderer::GetDitherMode() const {
+    return ditherMode;
+}
+
+void SimpleRenderer::SetStableDither(bool enabled) {
+    useStableDither = enabled;
+}
+
+bool SimpleRenderer::IsStableDither() const {
+    return useStableDither;
+}
+
+// SIMD level setter and getter (clamped to what the CPU supports)
+void SimpleRenderer::SetSimdLevel(SimdLevel level) {
+    init_simd(context, level);
+}
+
+SimdLevel SimpleRenderer::GetSimdLevel() const {
+    return context.simd_level;
+}
+
+// Decimal digits straight into the output
+char* SimpleRenderer::WriteInt(char* out, int value) {
+    return std::to_chars(out, out + 11, value).ptr;
+}
+
+void SimpleRenderer::AppendInt(AnsiBuffer& out, int value) {
+    out.commit(WriteInt(out.grow(11), value));
+}
+
+// What a cell stores of a color: the nearest palette index in the 4-bit and 8-bit modes (one table load), so that the colors quantized
+// to the same code make one run and compare equal from one frame to the next, 0xRRGGBB in truecolor
+template<ColorMode mode>
+std::uint32_t SimpleRenderer::ColorKey(int r, int g, int b) {
+    if constexpr (mode == ColorMode::COLOR_4BIT) {
+        return palette.Nearest16(r, g, b);
+    } else if constexpr (mode == ColorMode::COLOR_8BIT) {
+        return palette.Nearest256(r, g, b);
     } else {
-        // Blue dominant
-        if (r > g && r > b * 0.6)      color = 5; // Magenta
-        else if (g > b * 0.6)          color = 6; // Cyan
-        else                           color = 4; // Blue
+        return r << 16 | g << 8 | b;
     }
+}
 
-    return (useBright ? 90 : 30) + color;
+// Color escape copied from the precomputed tables, the color mode is fixed at compile time.
+// A continued escape joins the one just written: its 'm' becomes ';' and the "\033[" of this one is left out.
+template<ColorMode mode>
+char* SimpleRenderer::WriteColor(char* out, std::uint32_t key, bool isBackground, bool continued) {
+    if (key == ConsoleCell::DefaultColor) {
+        return continued ? AnsiWriteContinued(out, ansi.defaultColor[isBackground]) : AnsiWrite(out, ansi.defaultColor[isBackground]);
+    }
+    if constexpr (mode == ColorMode::COLOR_24BIT) {
+        out = continued ? AnsiWriteContinued(out, ansi.truecolor[isBackground]) : AnsiWrite(out, ansi.truecolor[isBackground]);
+        out = AnsiWrite(out, ansi.decimal[key >> 16]);
+        out = AnsiWrite(out, ansi.decimal[key >> 8 & 0xFF]);
+        out = AnsiWrite(out, ansi.decimal[key & 0xFF]);
+        *out++ = 'm';
+        return out;
+    } else {
+        const AnsiSequence& sequence = mode == ColorMode::COLOR_4BIT ? ansi.palette16[isBackground][key] : ansi.palette256[isBackground][key];
+        return continued ? AnsiWriteContinued(out, sequence) : AnsiWrite(out, sequence);
+    }
 }
 
+// Bytes WriteColor() would write
+template<ColorMode mode>
+int SimpleRenderer::ColorSize(std::uint32_t key, bool isBackground, bool continued) {
+    int size;
+    if (key == ConsoleCell::DefaultColor) {
+        size = ansi.defaultColor[isBackground].size;
+    } else if constexpr (mode == ColorMode::COLOR_24BIT) {
+        size = ansi.truecolor[isBackground].size + ansi.decimal[key >> 16].size + ansi.decimal[key >> 8 & 0xFF].size + ansi.decimal[key & 0xFF].size + 1;
+    } else {
+        size = (mode == ColorMode::COLOR_4BIT ? ansi.palette16[isBackground][key] : ansi.palette256[isBackground][key]).size;
+    }
+    return continued ? size - 2 : size;
+}
 
-// Convert RGB to 8-bit ANSI color (256 colors)
-int SimpleRenderer::RGBTo8Bit(int r, int g, int b) {
-    // Convert RGB to 6x6x6 color cube (216 colors) + 16 basic colors + 24 grayscale
-    if (r == g && g == b) {
-        // Grayscale
-        if (r < 8) return 16;
-        if (r > 248) return 231;
-        return 232 + (r - 8) / 10;
+// One cell per sampled framebuffer pixel, row after row
+template<ColorMode mode>
+void SimpleRenderer::SampleCells(int stepX, int stepY, int renderWidth, int renderHeight) {
+    frameColumns = (renderWidth + stepX - 1) / stepX;
+    frameRows = (renderHeight + stepY - 1) / stepY;
+    frameCells.resize(frameColumns * frameRows);
+    if constexpr (mode != ColorMode::COLOR_24BIT) {
+        if (ditherMode != DitherMode::NONE) {
+            SampleDitheredCells(mode == ColorMode::COLOR_4BIT ? 16 : 256, stepX, stepY);
+            return;
+        }
+    }
+    ditherCodesValid = false;
+    ConsoleCell* cell = frameCells.data();
+    for (int y = 0; y < renderHeight; y += stepY) {
+        for (int x = 0; x < renderWidth; x += stepX) {
+            TGAColor pixel = framebuffer.get(x, y);
+            cell->fg = ColorKey<mode>(pixel[2], pixel[1], pixel[0]);
+            cell->bg = ConsoleCell::DefaultColor;
+            cell->glyph = '#';
+            cell++;
+        }
     }
-    
-    // Color cube: 16 + 36*r + 6*g + b
-    int r6 = r * 5 / 255;
-    int g6 = g * 5 / 255;
-    int b6 = b * 5 / 255;
-    
-    return 16 + 36 * r6 + 6 * g6 + b6;
 }
 
-// Main color converter function
-std::string SimpleRenderer::ConvertToANSI(int r, int g, int b, bool isBackground) {
-    std::stringstream ansi;
-    
-    switch (currentColorMode) {
-        case ColorMode::COLOR_4BIT: {
-            int colorCode = RGBTo4Bit(r, g, b);
-            if (isBackground) {
-                // Convert foreground code to background (30-37 -> 40-47, 90-97 -> 100-107)
-                if (colorCode >= 90) colorCode = colorCode - 90 + 100;
-                else colorCode = colorCode - 30 + 40;
-            }
-            ansi << "\033[" << colorCode << "m";
-            break;
+// Dithered cells of the 4-bit and 8-bit modes, one row of cells per job. The Bayer spread and the hysteresis are about
+// a palette step: the 16 colors are some 128 apart on each channel, the levels of the 256 color cube 40 to 95.
+// Error diffusion needs the error of the cell above right, so each row follows the row above two cells behind.
+void SimpleRenderer::SampleDitheredCells(int colors, int stepX, int stepY) {
+    const int columns = frameColumns;
+    const int rows = frameRows;
+    const std::size_t cells = std::size_t(columns) * rows;
+    const int amplitude = colors == 16 ? 128 : 64;
+    const DitherQuantizer quantizer = {palette, colors, useStableDither ? (colors == 16 ? 32.0f : 12.0f) : 0.0f};
+    bool stable = useStableDither && ditherCodesValid && columns == screenColumns && rows == screenRows;
+    ditherPixels.resize(cells);
+    ditherCodes.resize(cells);
+    if (ditherMode == DitherMode::ERROR_DIFFUSION) {
+        ditherErrors.resize(cells * 3);
+        if (ditherProgressRows < rows) {
+            ditherProgress.reset(new std::atomic<int>[rows]);
+            ditherProgressRows = rows;
         }
-        
-        case ColorMode::COLOR_8BIT: {
-            int colorCode = RGBTo8Bit(r, g, b);
-            if (isBackground) {
-                ansi << "\033[48;5;" << colorCode << "m";
-            } else {
-                ansi << "\033[38;5;" << colorCode << "m";
+        for (int row = 0; row < rows; row++) {
+            ditherProgress[row].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    const std::uint8_t* image = framebuffer.buffer();
+    const int imageWidth = framebuffer.width();
+    threadPool.parallel_for(rows, [&](int row) {
+        // Sampled pixels of the row, packed b,g,r,a as in the RGBA framebuffer
+        std::uint32_t* pixels = &ditherPixels[std::size_t(row) * columns];
+        std::uint8_t* codes = &ditherCodes[std::size_t(row) * columns];
+        const std::uint8_t* source = image + std::size_t(row) * stepY * imageWidth * 4;
+        for (int column = 0; column < columns; column++) {
+            std::memcpy(&pixels[column], source + std::size_t(column) * stepX * 4, 4);
+        }
+
+        if (ditherMode == DitherMode::ORDERED) {
+            OrderedDitherRow(pixels, columns, row, amplitude, context.simd_level);
+            for (int column = 0; column < columns; column++) {
+                std::uint32_t pixel = pixels[column];
+                codes[column] = std::uint8_t(quantizer.Quantize(pixel >> 16 & 0xFF, pixel >> 8 & 0xFF, pixel & 0xFF, stable ? codes[column] : -1));
+            }
+        } else {
+            // Chunks of cells, each one started once the row above is two cells ahead of its end
+            const int chunk = 32;
+            const std::int16_t* above = row > 0 ? &ditherErrors[std::size_t(row - 1) * columns * 3] : nullptr;
+            std::int16_t* below = &ditherErrors[std::size_t(row) * columns * 3];
+            int carried[3] = {0, 0, 0};
+            for (int begin = 0; begin < columns; begin += chunk) {
+                int end = MIN(begin + chunk, columns);
+                if (row > 0) {
+                    int needed = MIN(end + 1, columns);
+                    while (ditherProgress[row - 1].load(std::memory_order_acquire) < needed) {
+                        std::this_thread::yield();
+                    }
+                }
+                DiffuseErrorRow(quantizer, pixels, codes, stable, begin, end, above, below, carried);
+                ditherProgress[row].store(end, std::memory_order_release);
             }
-            break;
         }
-        
-        case ColorMode::COLOR_24BIT:
-        default: {
-            if (isBackground) {
-                ansi << "\033[48;2;" << r << ";" << g << ";" << b << "m";
-            } else {
-                ansi << "\033[38;2;" << r << ";" << g << ";" << b << "m";
+
+        ConsoleCell* cell = &frameCells[std::size_t(row) * columns];
+        for (int column = 0; column < columns; column++) {
+            cell[column].fg = codes[column];
+            cell[column].bg = ConsoleCell::DefaultColor;
+            cell[column].glyph = '#';
+        }
+    });
+    ditherCodesValid = true;
+}
+
+// A cell, preceded by the smallest change of the terminal state that gives it its colors:
+// nothing when they are already active, a single escape when both the fg and the bg change
+template<ColorMode mode>
+char* SimpleRenderer::WriteCell(char* out, const ConsoleCell& cell, AnsiState& state) {
+    bool fgChange = cell.fg != state.fg;
+    if (fgChange) {
+        out = WriteColor<mode>(out, cell.fg, false, false);
+        state.fg = cell.fg;
+    }
+    if (cell.bg != state.bg) {
+        out = WriteColor<mode>(out, cell.bg, true, fgChange);
+        state.bg = cell.bg;
+    }
+    *out++ = cell.glyph;
+    return out;
+}
+
+// Bytes WriteCell() would write
+template<ColorMode mode>
+int SimpleRenderer::CellSize(const ConsoleCell& cell, AnsiState& state) {
+    int size = 1;
+    bool fgChange = cell.fg != state.fg;
+    if (fgChange) {
+        size += ColorSize<mode>(cell.fg, false, false);
+        state.fg = cell.fg;
+    }
+    if (cell.bg != state.bg) {
+        size += ColorSize<mode>(cell.bg, true, fgChange);
+        state.bg = cell.bg;
+    }
+    return size;
+}
+
+// Room for the worst case is made once, then the cells are written without any check nor allocation
+static const int MaxCellBytes = 2 * 20 + 1;  // truecolor fg and bg escapes (19 bytes each) and the glyph
+static const int MaxRowBytes = 32;           // cursor moves and resets around a row
+
+template<ColorMode mode>
+void SimpleRenderer::EmitCells(bool redraw) {
+    char* out = output.grow(frameCells.size() * MaxCellBytes + (frameRows + 1) * MaxRowBytes);
+    out = redraw ? EmitFullFrame<mode>(out) : EmitDifference<mode>(out);
+    output.commit(out);
+}
+
+// Every cell. The terminal state carries over from one row to the next: a row starting with the color the
+// previous one ended with needs no escape, and nothing is reset before the end of the frame.
+template<ColorMode mode>
+char* SimpleRenderer::EmitFullFrame(char* out) {
+    AnsiState state;
+    for (int y = 0; y < frameRows; y++) {
+        const ConsoleCell* row = &frameCells[y * frameColumns];
+        for (int x = 0; x < frameColumns; x++) {
+            out = WriteCell<mode>(out, row[x], state);
+        }
+        if (state.bg != ConsoleCell::DefaultColor) {
+            out = WriteColor<mode>(out, ConsoleCell::DefaultColor, true, false); // a scrolling terminal fills the new line with the active bg
+            state.bg = ConsoleCell::DefaultColor;
+        }
+        *out++ = '\n';
+    }
+    std::memcpy(out, "\033[0m", 4);
+    return out + 4;
+}
+
+// Changed cells only. Between two changes on a row, the unchanged cells are written again when that is shorter
+// than skipping them with a cursor move: a short gap of the active color costs a byte per cell, a jump 4 bytes or more.
+template<ColorMode mode>
+char* SimpleRenderer::EmitDifference(char* out) {
+    AnsiState state;
+    for (int y = 0; y < frameRows; y++) {
+        const ConsoleCell* row = &frameCells[y * frameColumns];
+        const ConsoleCell* previous = &screenCells[y * frameColumns];
+        int cursor = -1; // column of the terminal cursor when it is on this row
+        for (int x = 0; x < frameColumns; x++) {
+            if (row[x] == previous[x]) {
+                continue;
             }
-            break;
+            if (cursor < 0) {
+                // Rows are 1-based and the image starts below the header
+                *out++ = '\033';
+                *out++ = '[';
+                out = WriteInt(out, y + 2);
+                *out++ = ';';
+                out = WriteInt(out, x + 1);
+                *out++ = 'H';
+            } else if (cursor < x) {
+                int gap = x - cursor;
+                int jumpCost = gap < 10 ? 4 : gap < 100 ? 5 : 6; // \033[<gap>C
+                int rewriteCost = 0;
+                AnsiState rewriteState = state;
+                for (int i = cursor; i < x && rewriteCost <= jumpCost; i++) {
+                    rewriteCost += CellSize<mode>(row[i], rewriteState);
+                }
+                if (rewriteCost <= jumpCost) {
+                    for (int i = cursor; i < x; i++) {
+                        out = WriteCell<mode>(out, row[i], state);
+                    }
+                } else {
+                    *out++ = '\033';
+                    *out++ = '[';
+                    out = WriteInt(out, gap);
+                    *out++ = 'C';
+                }
+            }
+            out = WriteCell<mode>(out, row[x], state);
+            cursor = x + 1;
         }
     }
-    
-    return ansi.str();
+
+    // Colors reset and cursor below the image, where a whole frame leaves them
+    std::memcpy(out, "\033[0m\033[", 6);
+    out = WriteInt(out + 6, frameRows + 2);
+    std::memcpy(out, ";1H", 3);
+    return out + 3;
+}
+
+template<ShadingMode mode>
+void SimpleRenderer::DrawModel(const Model& model, const vec3& light) {
+    SimpleShader<mode> shader(context, light, model, clipVerts, eyeNormals, textureFilter);
+    if (useReferenceRasterizer) {
+        for (int f = 0; f < model.nfaces(); f++) {
+            BasicTriangle<RenderReal> clip = {
+                vec_cast<RenderReal>(shader.vertex(f, 0)),
+                vec_cast<RenderReal>(shader.vertex(f, 1)),
+                vec_cast<RenderReal>(shader.vertex(f, 2))
+            };
+            rasterize_reference(context, clip, shader, framebuffer);
+        }
+        return;
+    }
+
+    // Bin the whole mesh into screen tiles, then rasterize the tiles in parallel
+    binner.begin(context, framebuffer.width(), framebuffer.height());
+    binner.set_occlusion_culling(useOcclusionCulling);
+    for (int f = 0; f < model.nfaces(); f++) {
+        if (clipVerts.outcode[model.vert_index(f, 0)] & clipVerts.outcode[model.vert_index(f, 1)] & clipVerts.outcode[model.vert_index(f, 2)]) {
+            continue; // all three corners outside of the same side of the framebuffer
+        }
+        BasicTriangle<RenderReal> clip = {
+            vec_cast<RenderReal>(shader.vertex(f, 0)),
+            vec_cast<RenderReal>(shader.vertex(f, 1)),
+            vec_cast<RenderReal>(shader.vertex(f, 2))
+        };
+        binner.submit(clip, f);
+    }
+    if (useVisibilityBuffer) {
+        binner.flush_visibility(shader, framebuffer, threadPool);
+    } else {
+        binner.flush(shader, framebuffer, threadPool);
+    }
 }
 
 void SimpleRenderer::RenderFrame() {
-    if (!model) {
+    // Meshes and textures loaded in the background since the last frame
+    scene.Update();
+
+    if (scene.InstanceCount() == 0) {
         return;
     }
 
@@ -212,33 +641,63 @@ void SimpleRenderer::RenderFrame() {
     int renderWidth  = currentConsoleWidth - 1;
     int renderHeight = currentConsoleHeight - 3;
 
-    static float angle = 0.0f;
     angle += 0.05f; // Rotate model slowly
 
     // Camera + lighting
     vec3 light{1, 1, 1};
-    vec3 eye{2 * cos(angle), 1, 2 * sin(angle)};
-    vec3 center{0, 0, 0};
-    vec3 up{0, 1, 0};
+    vec<3,RenderReal> eye{RenderReal(2 * cos(angle)), 1, RenderReal(2 * sin(angle))};
+    vec<3,RenderReal> center{0, 0, 0};
+    vec<3,RenderReal> up{0, 1, 0};
 
     // Build matrices
-    lookat(eye, center, up);
-    init_perspective(norm(eye - center));
-    init_viewport(renderWidth / 8, renderHeight / 8, renderWidth * 3 / 4, renderHeight * 3 / 4);
-    init_zbuffer(renderWidth, renderHeight);
-
-    // Create framebuffer
-    TGAImage framebuffer(renderWidth, renderHeight, TGAImage::RGBA, {50, 50, 100, 255});
-
-    // Render model
-    SimpleShader shader(light, *model);
-    for (int f = 0; f < model->nfaces(); f++) {
-        Triangle clip = {
-            shader.vertex(f, 0),
-            shader.vertex(f, 1),
-            shader.vertex(f, 2)
-        };
-        rasterize(clip, shader, framebuffer);
+    lookat(context, eye, center, up);
+    init_perspective(context, norm(eye - center));
+    init_viewport(context, renderWidth / 8, renderHeight / 8, renderWidth * 3 / 4, renderHeight * 3 / 4);
+    init_zbuffer(context, renderWidth, renderHeight);
+
+    // Clear the framebuffer, reallocate it only when the console was resized
+    TGAColor background = {50, 50, 100, 255};
+    if (framebuffer.width() != renderWidth || framebuffer.height() != renderHeight) {
+        framebuffer = TGAImage(renderWidth, renderHeight, TGAImage::RGBA, background);
+    } else {
+        framebuffer.fill(background);
+    }
+
+    // Instances one after the other, sharing the z-buffer; meshes stay together so their data and textures stay in cache
+    mat<4,4,RenderReal> viewProjection = context.Perspective * context.ModelView;
+    int visibleInstances = 0;
+    int drawnFaces = 0;
+    for (int instanceIndex : scene.DrawOrder(vec_cast<double>(eye))) {
+        const SceneInstance& instance = scene.GetInstance(instanceIndex);
+        Model& model = scene.GetMesh(instance.mesh);
+
+        // Whole-instance frustum test: nothing to transform nor rasterize when the bounding sphere is off screen
+        auto [sphereCenter, sphereRadius] = model.bounding_sphere<RenderReal>();
+        mat<4,4,RenderReal> modelViewProjection = viewProjection * mat_cast<RenderReal>(instance.transform);
+        if (!sphere_in_frustum(context, modelViewProjection, sphereCenter, sphereRadius, renderWidth, renderHeight)) {
+            continue;
+        }
+
+        // Level of detail: about one triangle per covered cell
+        model.select_lod(useLevelOfDetail ? model.lod_for_area(sphere_screen_area(context, modelViewProjection, sphereCenter, sphereRadius)) : 0);
+
+        // Vertex stage: per-instance uniforms, then every unique vertex and normal transformed once, in parallel
+        mat4f projection(mat_cast<double>(modelViewProjection));
+        mat4f normalMatrix = mat4f(mat_cast<double>(context.ModelView * mat_cast<RenderReal>(instance.transform))).invert_transpose();
+        transform_vertices(context, projection, model.vert_data(0), model.vert_data(1), model.vert_data(2), 1.f, model.nverts(),
+                           renderWidth, renderHeight, clipVerts, threadPool);
+        transform_vertices(context, normalMatrix, model.normal_data(0), model.normal_data(1), model.normal_data(2), 0.f, model.nnormals(),
+                           renderWidth, renderHeight, eyeNormals, threadPool);
+
+        // Render the instance with the shader variant of the current shading mode
+        switch (shadingMode) {
+            case ShadingMode::FLAT:         DrawModel<ShadingMode::FLAT>(model, light);         break;
+            case ShadingMode::GOURAUD:      DrawModel<ShadingMode::GOURAUD>(model, light);      break;
+            case ShadingMode::TEXTURED:     DrawModel<ShadingMode::TEXTURED>(model, light);     break;
+            case ShadingMode::TEXTURED_LIT: DrawModel<ShadingMode::TEXTURED_LIT>(model, light); break;
+        }
+        visibleInstances++;
+        drawnFaces += model.nfaces();
     }
 
     // Sampling step sizes (avoid repeated division)
@@ -248,60 +707,82 @@ void SimpleRenderer::RenderFrame() {
     // Clear console + move cursor
     console.MoveCursor(1, 1);
 
-    std::string output;
-    output.reserve(renderWidth * renderHeight); // pre-allocate
+    output.clear(); // keeps the capacity of the previous frames
 
     // Header info
     output += "\033[1;36m3D Model Render (";
-    output += std::to_string(stepX);
+    AppendInt(output, stepX);
     output += "x";
-    output += std::to_string(stepY);
+    AppendInt(output, stepY);
     output += ") Internal:";
-    output += std::to_string(renderWidth);
+    AppendInt(output, renderWidth);
     output += "x";
-    output += std::to_string(renderHeight);
+    AppendInt(output, renderHeight);
     output += " Console:";
-    output += std::to_string(currentConsoleWidth);
+    AppendInt(output, currentConsoleWidth);
     output += "x";
-    output += std::to_string(currentConsoleHeight);
+    AppendInt(output, currentConsoleHeight);
     output += " Mode:";
     output += (currentColorMode == ColorMode::COLOR_4BIT ? "4bit" :
                currentColorMode == ColorMode::COLOR_8BIT ? "8bit" : "24bit");
+    if (currentColorMode != ColorMode::COLOR_24BIT && ditherMode != DitherMode::NONE) {
+        output += (ditherMode == DitherMode::ORDERED ? " Dither:bayer" : " Dither:sierra");
+    }
+    output += " Raster:";
+    output += (useReferenceRasterizer ? "ref" : "edge");
+    output += " Threads:";
+    AppendInt(output, useReferenceRasterizer ? 1 : threadPool.size());
+    output += " SIMD:";
+    output += (useReferenceRasterizer ? "off" : simd_name(context.simd_level));
+    output += " Shade:";
+    output += (!useReferenceRasterizer && useVisibilityBuffer ? "deferred" : "forward");
+    output += " HiZ:";
+    output += (!useReferenceRasterizer && useOcclusionCulling ? "on" : "off");
+    output += " Inst:";
+    AppendInt(output, visibleInstances);
+    output += "/";
+    AppendInt(output, scene.InstanceCount());
+    output += " Faces:";
+    AppendInt(output, drawnFaces);
+    if (scene.PendingCount() > 0) {
+        output += " Loading:";
+        AppendInt(output, scene.PendingCount());
+    }
+    output += " Shader:";
+    output += (shadingMode == ShadingMode::FLAT ? "flat" :
+               shadingMode == ShadingMode::GOURAUD ? "gouraud" :
+               shadingMode == ShadingMode::TEXTURED ? "tex" : "tex+lit");
+    output += " Tex:";
+    output += (textureFilter == TextureFilter::NEAREST ? "nearest" :
+               textureFilter == TextureFilter::MIPMAP ? "mip" : "trilinear");
     output += " Frame:";
-    output += std::to_string(static_cast<int>(angle * 10));
-    output += "\033[0m\n";
-
-    // Framebuffer sampling + RLE
-    for (int y = 0; y < renderHeight; y += stepY) {
-        int x = 0;
-        while (x < renderWidth) {
-            TGAColor pixel = framebuffer.get(x, y);
-            int r = pixel[2];
-            int g = pixel[1];
-            int b = pixel[0];
-
-            // Precompute ANSI once
-            std::string colorCode = ConvertToANSI(r, g, b, false);
-
-            // Run-length encoding
-            int repeatCount = 1;
-            while (x + repeatCount * stepX < renderWidth) {
-                TGAColor next = framebuffer.get(x + repeatCount * stepX, y);
-                if (next[0] == pixel[0] && next[1] == pixel[1] && next[2] == pixel[2]) {
-                    repeatCount++;
-                } else {
-                    break;
-                }
-            }
-
-            // Output chunk
-            output += colorCode;
-            output.append(repeatCount, '#');
+    AppendInt(output, static_cast<int>(angle * 10));
 
-            x += repeatCount * stepX;
-        }
-        output += "\033[0m\n"; // reset only once per line
+    // Console image: the framebuffer sampled into cells, then sent whole or as its difference with the previous frame
+    switch (currentColorMode) {
+        case ColorMode::COLOR_4BIT:  SampleCells<ColorMode::COLOR_4BIT>(stepX, stepY, renderWidth, renderHeight);  break;
+        case ColorMode::COLOR_8BIT:  SampleCells<ColorMode::COLOR_8BIT>(stepX, stepY, renderWidth, renderHeight);  break;
+        case ColorMode::COLOR_24BIT: SampleCells<ColorMode::COLOR_24BIT>(stepX, stepY, renderWidth, renderHeight); break;
+    }
+    bool redraw = !useDifferentialOutput || !screenValid || frameColumns != screenColumns || frameRows != screenRows;
+    bool headerChanged = redraw || screenHeader.size() != output.size() || std::memcmp(screenHeader.data(), output.data(), output.size()) != 0;
+    screenHeader.assign(output.data(), output.size());
+    if (redraw) {
+        output += "\033[0m\n";
+    } else if (headerChanged) {
+        output += "\033[0m\033[K"; // the header may have become shorter
+    } else {
+        output.clear();
+    }
+    switch (currentColorMode) {
+        case ColorMode::COLOR_4BIT:  EmitCells<ColorMode::COLOR_4BIT>(redraw);  break;
+        case ColorMode::COLOR_8BIT:  EmitCells<ColorMode::COLOR_8BIT>(redraw);  break;
+        case ColorMode::COLOR_24BIT: EmitCells<ColorMode::COLOR_24BIT>(redraw); break;
     }
+    screenCells.swap(frameCells);
+    screenColumns = frameColumns;
+    screenRows = frameRows;
+    screenValid = true;
 
     console.Print(output.c_str());
 }
@@ -3,8 +3,20 @@
 
 #include "../tinyrenderer-master/our_gl.h"
 #include "../tinyrenderer-master/model.h"
+#include "scene.hpp"
+#include "ansi.hpp"
+#include "palette.hpp"
+#include "dither.hpp"
+#include "../tinyrenderer-master/fmath.h"
 #include "../console/console.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Scalar type of the geometry stage (matrices, frustum culling, clipping): double, or float for the single precision build
+typedef double RenderReal;
 
 // ANSI Color Modes
 enum class ColorMode {
@@ -13,10 +25,50 @@ enum class ColorMode {
     COLOR_24BIT   // Truecolor (38;2;R;G;B and 48;2;R;G;B)
 };
 
+// Diffuse texture filtering
+enum class TextureFilter {
+    NEAREST,      // nearest texel of the full resolution texture
+    MIPMAP,       // nearest texel of the mip level matching the cell footprint
+    TRILINEAR     // bilinear lookups in the two closest mip levels, blended
+};
+
+// Shader variants, each one compiled into its own raster loops
+enum class ShadingMode {
+    FLAT,         // one lighting value per face
+    GOURAUD,      // lighting at the vertices, interpolated
+    TEXTURED,     // diffuse texture, no lighting
+    TEXTURED_LIT  // diffuse texture with per-pixel lighting
+};
+
+// Dithering of the 4-bit and 8-bit modes, between the framebuffer and the color quantization
+enum class DitherMode {
+    NONE,            // nearest palette color
+    ORDERED,         // 4x4 Bayer pattern anchored to the cells
+    ERROR_DIFFUSION  // Sierra Lite, the rows run in parallel a few cells behind each other
+};
+
+// One character cell of the console image
+struct ConsoleCell {
+    static constexpr std::uint32_t DefaultColor = 0xFFFFFFFF;  // the terminal default, no escape sequence
+    std::uint32_t fg;  // color key of the current color mode (see ColorKey) or DefaultColor
+    std::uint32_t bg;
+    char glyph;
+
+    bool operator==(const ConsoleCell& other) const {
+        return fg == other.fg && bg == other.bg && glyph == other.glyph;
+    }
+};
+
+// Colors the terminal applies to the next character, tracked so that only their changes are emitted
+struct AnsiState {
+    std::uint32_t fg = ConsoleCell::DefaultColor;
+    std::uint32_t bg = ConsoleCell::DefaultColor;
+};
+
 class SimpleRenderer {
 private:
     ConsoleManager& console;  // Changed from pointer to reference
-    Model* model;
+    Scene scene;              // meshes and their instances
     static const int width = 0;
     static const int height = 0;
     
@@ -29,19 +81,116 @@ private:
     // Color mode setting
     ColorMode currentColorMode;
     
-    // Color conversion functions
-    std::string ConvertToANSI(int r, int g, int b, bool isBackground = false);
-    int RGBTo4Bit(int r, int g, int b, bool isBright = false);
-    int RGBTo8Bit(int r, int g, int b);
+    // Rasterizer selection (reference path kept for A/B comparison)
+    bool useReferenceRasterizer;
+    
+    // Vertex stage output (clip space positions, eye space normals)
+    VertexBuffer clipVerts;
+    VertexBuffer eyeNormals;
+    
+    // Tile-binned rasterization and its worker threads
+    BasicBinnedRasterizer<RenderReal> binner;
+    ThreadPool threadPool;
+    int renderThreads;
+    
+    // Deferred shading through a visibility buffer (one fragment shader call per visible pixel)
+    bool useVisibilityBuffer;
+    
+    // Hierarchical z occlusion culling with front-to-back triangle order
+    bool useOcclusionCulling;
+    
+    // Level of detail picked from the projected size of the model
+    bool useLevelOfDetail;
+    
+    // Texture sampling
+    TextureFilter textureFilter;
+    
+    // Fragment shader variant
+    ShadingMode shadingMode;
+    
+    // Matrices, viewport and depth buffer of this renderer (no global state: renderers can run on separate threads)
+    BasicRenderContext<RenderReal> context;
+    float angle;
+    
+    // Render targets and console text kept from one frame to the next (reallocated on resize only)
+    TGAImage framebuffer;
+    AnsiBuffer output;
+    const AnsiTables& ansi;   // every color escape, precomputed
+    const PaletteTables& palette; // RGB to the nearest 4-bit and 8-bit codes
+    
+    // Console image of this frame, and the one the terminal shows (retained for differential output)
+    bool useDifferentialOutput;
+    std::vector<ConsoleCell> frameCells;
+    std::vector<ConsoleCell> screenCells;
+    std::string screenHeader;
+    int frameColumns, frameRows;
+    int screenColumns, screenRows;
+    bool screenValid;         // false until a whole frame was sent after the last invalidation
+    
+    // Dithering of the low color modes, and the buffers it keeps from one frame to the next
+    DitherMode ditherMode;
+    bool useStableDither;     // cells keep their previous code while it is still close: no crawling patterns, small differential output
+    bool ditherCodesValid;    // ditherCodes hold the codes of the previous frame
+    std::vector<std::uint32_t> ditherPixels;   // sampled pixels, row after row
+    std::vector<std::uint8_t> ditherCodes;     // palette code of every cell
+    std::vector<std::int16_t> ditherErrors;    // error diffused from each row to the next, 3 channels per cell
+    std::unique_ptr<std::atomic<int>[]> ditherProgress; // cells done in each row (error diffusion wavefront)
+    int ditherProgressRows;
+    
+    // Color conversion functions (write through a pointer into room made beforehand, see AnsiBuffer)
+    template<ColorMode mode> std::uint32_t ColorKey(int r, int g, int b);
+    template<ColorMode mode> char* WriteColor(char* out, std::uint32_t key, bool isBackground, bool continued);
+    template<ColorMode mode> int ColorSize(std::uint32_t key, bool isBackground, bool continued);
+    template<ColorMode mode> char* WriteCell(char* out, const ConsoleCell& cell, AnsiState& state);
+    template<ColorMode mode> int CellSize(const ConsoleCell& cell, AnsiState& state);
+    static char* WriteInt(char* out, int value);
+    static void AppendInt(AnsiBuffer& out, int value);
+    
+    // Console output: framebuffer to cells, then the cells to escape sequences, one specialization per color mode
+    template<ColorMode mode> void SampleCells(int stepX, int stepY, int renderWidth, int renderHeight);
+    void SampleDitheredCells(int colors, int stepX, int stepY);
+    template<ColorMode mode> void EmitCells(bool redraw);
+    template<ColorMode mode> char* EmitFullFrame(char* out);
+    template<ColorMode mode> char* EmitDifference(char* out);
+    
+    // Vertex fetch + rasterization of one instance into the framebuffer with the shader variant of the given mode
+    template<ShadingMode mode>
+    void DrawModel(const Model& model, const vec3& light);
 
 public:
     SimpleRenderer(ConsoleManager& consoleManager);  // Changed parameter to reference
     ~SimpleRenderer();
-    bool LoadModel(const std::string& filename);
+    bool LoadModel(const std::string& filename);   // replaces the scene by this model alone
+    bool AddModelInstance(const std::string& filename, const mat<4,4>& transform); // one more instance, the mesh is loaded once per file
+    bool RequestModelInstance(const std::string& filename, const mat<4,4>& transform, AssetLoader& loader); // same, loaded in the background: drawn once it arrives, see Scene::RequestMesh()
+    Scene& GetScene();
     void RenderFrame();
     void UpdateConsoleSize();
     void SetColorMode(ColorMode mode);
     ColorMode GetColorMode() const;
+    void SetDifferentialOutput(bool enabled);
+    bool IsDifferentialOutput() const;
+    void InvalidateOutput();   // the next frame is sent whole, e.g. after something else was printed over the image
+    void SetReferenceRasterizer(bool enabled);
+    bool IsReferenceRasterizer() const;
+    void SetRenderThreads(int threads);
+    int GetRenderThreads() const;
+    void SetVisibilityBuffer(bool enabled);
+    bool IsVisibilityBuffer() const;
+    void SetOcclusionCulling(bool enabled);
+    bool IsOcclusionCulling() const;
+    void SetLevelOfDetail(bool enabled);
+    bool IsLevelOfDetail() const;
+    void SetTextureFilter(TextureFilter filter);
+    TextureFilter GetTextureFilter() const;
+    void SetShadingMode(ShadingMode mode);
+    ShadingMode GetShadingMode() const;
+    void SetDitherMode(DitherMode mode);
+    DitherMode GetDitherMode() const;
+    void SetStableDither(bool enabled);
+    bool IsStableDither() const;
+    void SetSimdLevel(SimdLevel level);
+    SimdLevel GetSimdLevel() const;
 };
 
 #endif // RENDER_HPP
\ No newline at end of file
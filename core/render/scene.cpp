@@ -0,0 +1,166 @@
+#include "scene.hpp"
+#include <algorithm>
+#include <cmath>
+
+Scene::Scene() {
+    failedMeshes = 0;
+}
+
+int Scene::AddMesh(const std::string& filename) {
+    // Already loaded: the new instances share it
+    for (int i = 0; i < (int)meshFiles.size(); i++) {
+        if (meshFiles[i] == filename) {
+            return i;
+        }
+    }
+
+    std::unique_ptr<Model> model = std::make_unique<Model>(filename);
+    if (model->nfaces() == 0) {
+        return -1;
+    }
+    meshes.push_back(std::move(model));
+    meshFiles.push_back(filename);
+    return (int)meshes.size() - 1;
+}
+
+int Scene::RequestMesh(const std::string& filename, AssetLoader& loader) {
+    for (int i = 0; i < (int)meshFiles.size(); i++) {
+        if (meshFiles[i] == filename) {
+            return i;
+        }
+    }
+
+    int mesh = (int)meshes.size();
+    meshes.push_back(nullptr);
+    meshFiles.push_back(filename);
+
+    // Geometry first, then the maps: they only need the file name, so all of them load side by side
+    pendingMeshes.push_back({mesh, loader.Submit([filename]() { return std::make_unique<Model>(filename, true, false); })});
+    for (Model::Map map : {Model::DIFFUSE, Model::NORMAL, Model::SPECULAR}) {
+        pendingMaps.push_back({mesh, map, loader.Submit([filename, map]() { return Model::load_map(filename, map); })});
+    }
+    return mesh;
+}
+
+int Scene::AddInstance(int mesh, const mat<4,4>& transform) {
+    if (mesh < 0 || mesh >= MeshCount()) {
+        return -1;
+    }
+    instances.push_back({mesh, transform});
+    return (int)instances.size() - 1;
+}
+
+void Scene::SetTransform(int instance, const mat<4,4>& transform) {
+    instances[instance].transform = transform;
+}
+
+void Scene::Clear() {
+    instances.clear();
+    meshes.clear();
+    meshFiles.clear();
+    pendingMeshes.clear();  // the loads still running finish on their own, their results are dropped
+    pendingMaps.clear();
+    failedMeshes = 0;
+}
+
+int Scene::Update() {
+    int installed = 0;
+    for (int i = 0; i < (int)pendingMeshes.size(); ) {
+        PendingMesh& pending = pendingMeshes[i];
+        if (!AssetLoader::IsReady(pending.model)) {
+            i++;
+            continue;
+        }
+        std::unique_ptr<Model> model;
+        try {
+            model = pending.model.get();
+        } catch (const std::exception&) {
+            model = nullptr;
+        }
+        if (model && model->nfaces() > 0) {
+            meshes[pending.mesh] = std::move(model);
+            installed++;
+        } else {
+            failedMeshes++;
+        }
+        pendingMeshes.erase(pendingMeshes.begin() + i);
+    }
+
+    // A map waits for its mesh, the mesh is drawn without it meanwhile
+    for (int i = 0; i < (int)pendingMaps.size(); ) {
+        PendingMap& pending = pendingMaps[i];
+        bool meshPending = !meshes[pending.mesh] && std::any_of(pendingMeshes.begin(), pendingMeshes.end(), [&](const PendingMesh& m) { return m.mesh == pending.mesh; });
+        if (meshPending || !AssetLoader::IsReady(pending.texture)) {
+            i++;
+            continue;
+        }
+        if (meshes[pending.mesh]) {
+            try {
+                meshes[pending.mesh]->set_map(pending.map, pending.texture.get());
+                installed++;
+            } catch (const std::exception&) {
+                // the mesh keeps its placeholder material
+            }
+        }
+        pendingMaps.erase(pendingMaps.begin() + i);
+    }
+    return installed;
+}
+
+int Scene::PendingCount() const {
+    return (int)(pendingMeshes.size() + pendingMaps.size());
+}
+
+int Scene::FailedCount() const {
+    return failedMeshes;
+}
+
+bool Scene::IsMeshReady(int mesh) const {
+    return mesh >= 0 && mesh < MeshCount() && meshes[mesh] != nullptr;
+}
+
+int Scene::MeshCount() const {
+    return (int)meshes.size();
+}
+
+int Scene::InstanceCount() const {
+    return (int)instances.size();
+}
+
+Model& Scene::GetMesh(int mesh) {
+    return *meshes[mesh];
+}
+
+const SceneInstance& Scene::GetInstance(int instance) const {
+    return instances[instance];
+}
+
+const std::vector<int>& Scene::DrawOrder(const vec3& eye) {
+    drawOrder.clear();
+    drawDistance.resize(instances.size());
+    for (int i = 0; i < (int)instances.size(); i++) {
+        const SceneInstance& instance = instances[i];
+        if (!meshes[instance.mesh]) {
+            continue;
+        }
+        vec3 center = meshes[instance.mesh]->bounding_sphere().first;
+        vec3 world = (instance.transform * vec4{center.x, center.y, center.z, 1.}).xyz();
+        drawOrder.push_back(i);
+        drawDistance[i] = (world - eye) * (world - eye);
+    }
+
+    // Same mesh together, then front to back so that the hierarchical z rejects more of the later instances
+    std::sort(drawOrder.begin(), drawOrder.end(), [&](int a, int b) {
+        if (instances[a].mesh != instances[b].mesh) {
+            return instances[a].mesh < instances[b].mesh;
+        }
+        return drawDistance[a] < drawDistance[b];
+    });
+    return drawOrder;
+}
+
+mat<4,4> Scene::Transform(const vec3& position, double scale, double yaw) {
+    double c = std::cos(yaw) * scale;
+    double s = std::sin(yaw) * scale;
+    return {{{c, 0, s, position.x}, {0, scale, 0, position.y}, {-s, 0, c, position.z}, {0, 0, 0, 1}}};
+}
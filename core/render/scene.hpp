@@ -0,0 +1,71 @@
+#if !defined(SCENE_HPP)
+#define SCENE_HPP
+
+#include "../tinyrenderer-master/model.h"
+#include "../loader/loader.hpp"
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One placement of a mesh in the world
+struct SceneInstance {
+    int mesh;              // index of the shared Model in the scene
+    mat<4,4> transform;    // model to world
+};
+
+// Meshes loaded once and drawn any number of times: instances only hold a transform,
+// vertex data, levels of detail and textures live in the one Model of their mesh.
+class Scene {
+private:
+    // Mesh and texture loads still running on an AssetLoader, installed by Update()
+    struct PendingMesh {
+        int mesh;
+        std::future<std::unique_ptr<Model>> model;
+    };
+    struct PendingMap {
+        int mesh;
+        Model::Map map;
+        std::future<Texture> texture;
+    };
+
+    std::vector<std::unique_ptr<Model>> meshes;   // null until a requested mesh has arrived
+    std::vector<std::string> meshFiles;      // file of every mesh, to share it between instances
+    std::vector<SceneInstance> instances;
+    std::vector<int> drawOrder;              // instance indices, reused from one frame to the next
+    std::vector<double> drawDistance;        // squared eye distance per instance, sort key of drawOrder
+    std::vector<PendingMesh> pendingMeshes;
+    std::vector<PendingMap> pendingMaps;
+    int failedMeshes;
+
+public:
+    Scene();
+
+    // Mesh loading (a file already in the scene is not loaded twice), -1 when the file has no triangles
+    int AddMesh(const std::string& filename);
+    // Same, without waiting: the index is valid at once, instances of the mesh are drawn once its geometry
+    // has arrived, without textures (the placeholder material) until its maps have arrived too
+    int RequestMesh(const std::string& filename, AssetLoader& loader);
+    int AddInstance(int mesh, const mat<4,4>& transform);
+    void SetTransform(int instance, const mat<4,4>& transform);
+    void Clear();
+
+    // Installs the requested meshes and maps that finished loading (never blocks), returns how many
+    int Update();
+    int PendingCount() const;                // requested meshes and maps not installed yet
+    int FailedCount() const;                 // requested meshes without any triangle (missing or broken file)
+    bool IsMeshReady(int mesh) const;
+
+    int MeshCount() const;
+    int InstanceCount() const;
+    Model& GetMesh(int mesh);                // only for a ready mesh
+    const SceneInstance& GetInstance(int instance) const;
+
+    // Instances of the ready meshes grouped by mesh (hence by texture set) for cache locality, nearest first inside of a group
+    const std::vector<int>& DrawOrder(const vec3& eye);
+
+    // Translation * rotation about the y axis * uniform scale
+    static mat<4,4> Transform(const vec3& position, double scale = 1.0, double yaw = 0.0);
+};
+
+#endif // SCENE_HPP
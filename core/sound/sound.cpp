@@ -989,13 +989,15 @@ bool load_wav_file(const char* filename) {
         return false;
     }
     
+    LeaveCriticalSection(&g_audioSystem.wavLock);
+    
+    // The file is read and converted without holding the lock: the mixer and the other loads go on meanwhile
     char full_path[512];
     snprintf(full_path, sizeof(full_path), "source/sound/%s", filename);
     
     FILE* file = fopen(full_path, "rb");
     if (!file) {
         printf("Failed to open WAV file: %s\n", full_path);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1003,7 +1005,6 @@ bool load_wav_file(const char* filename) {
     if (fread(&header, sizeof(WavHeader), 1, file) != 1) {
         printf("Failed to read WAV header: %s\n", filename);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1014,21 +1015,18 @@ bool load_wav_file(const char* filename) {
         strncmp(header.data, "data", 4) != 0) {
         printf("Invalid WAV format: %s\n", filename);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
     if (header.format != 1) {
         printf("Unsupported WAV format (not PCM): %s\n", filename);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
     if (header.bits_per_sample != 16 && header.bits_per_sample != 8 && header.bits_per_sample != 24 && header.bits_per_sample != 32) {
         printf("Unsupported bit depth (%d-bit): %s (supported: 8, 16, 24, 32-bit)\n", header.bits_per_sample, filename);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1039,7 +1037,6 @@ bool load_wav_file(const char* filename) {
     if (!raw_data) {
         printf("Failed to allocate memory for raw WAV data: %s\n", filename);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1048,7 +1045,6 @@ bool load_wav_file(const char* filename) {
         printf("Failed to read WAV audio data: %s\n", filename);
         free(raw_data);
         fclose(file);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1059,7 +1055,6 @@ bool load_wav_file(const char* filename) {
     if (!audio_data) {
         printf("Failed to allocate memory for converted WAV data: %s\n", filename);
         free(raw_data);
-        LeaveCriticalSection(&g_audioSystem.wavLock);
         return false;
     }
     
@@ -1110,6 +1105,25 @@ bool load_wav_file(const char* filename) {
     
     free(raw_data);
     
+    EnterCriticalSection(&g_audioSystem.wavLock);
+    
+    // Loaded by another thread in the meantime
+    for (int i = 0; i < g_audioSystem.wav_cache_count; i++) {
+        if (strcmp(g_audioSystem.wav_cache[i].filename, filename) == 0 && 
+            g_audioSystem.wav_cache[i].loaded) {
+            LeaveCriticalSection(&g_audioSystem.wavLock);
+            free(audio_data);
+            return true;
+        }
+    }
+    
+    if (g_audioSystem.wav_cache_count >= 32) {
+        printf("WAV cache full! Cannot load more files.\n");
+        LeaveCriticalSection(&g_audioSystem.wavLock);
+        free(audio_data);
+        return false;
+    }
+    
     // Store in cache
     WavData* wav_data = &g_audioSystem.wav_cache[g_audioSystem.wav_cache_count];
     wav_data->data = audio_data;
@@ -0,0 +1,117 @@
+#pragma once
+#include "geometry.h"
+#include "simd.h"
+
+// Aligned single precision counterparts of vec4 and mat<4,4> for the hot loops.
+// SSE2 is part of x86-64, so it is used unconditionally; AVX2 is reserved to the vertex and raster loops and dispatched at runtime.
+
+struct alignas(16) float4 {
+    float x = 0, y = 0, z = 0, w = 0;
+    float4() = default;
+    float4(const float x, const float y, const float z, const float w) : x(x), y(y), z(z), w(w) {}
+    explicit float4(const vec4 &v) : x(v.x), y(v.y), z(v.z), w(v.w) {}
+    explicit float4(const vec4f &v) : x(v.x), y(v.y), z(v.z), w(v.w) {}
+          float& operator[](const int i)       { assert(i>=0 && i<4); return (&x)[i]; }
+    const float& operator[](const int i) const { assert(i>=0 && i<4); return (&x)[i]; }
+#if defined(SIMD_X86)
+    explicit float4(const __m128 v) { _mm_store_ps(&x, v); }
+    __m128 m128() const { return _mm_load_ps(&x); }
+#endif
+};
+
+#if defined(SIMD_X86)
+inline float4 operator+(const float4 &a, const float4 &b) { return float4(_mm_add_ps(a.m128(), b.m128())); }
+inline float4 operator-(const float4 &a, const float4 &b) { return float4(_mm_sub_ps(a.m128(), b.m128())); }
+inline float4 operator*(const float4 &a, const float s)    { return float4(_mm_mul_ps(a.m128(), _mm_set1_ps(s))); }
+inline float  operator*(const float4 &a, const float4 &b) { // dot product
+    const __m128 p = _mm_mul_ps(a.m128(), b.m128());
+    const __m128 s = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(s, s)));
+}
+#else
+inline float4 operator+(const float4 &a, const float4 &b) { return {a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w}; }
+inline float4 operator-(const float4 &a, const float4 &b) { return {a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w}; }
+inline float4 operator*(const float4 &a, const float s)    { return {a.x*s, a.y*s, a.z*s, a.w*s}; }
+inline float  operator*(const float4 &a, const float4 &b) { return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w; }
+#endif
+
+inline float4 normalized(const float4 &v) {
+    return v * (1.f/std::sqrt(v*v));
+}
+
+struct alignas(16) mat4f { // column-major: m*v is a sum of four scaled columns, no horizontal adds
+    float4 cols[4] = {};
+    mat4f() = default;
+    explicit mat4f(const mat<4,4> &m) {
+        for (int j=4; j--; )
+            cols[j] = { float(m[0][j]), float(m[1][j]), float(m[2][j]), float(m[3][j]) };
+    }
+    float operator()(const int row, const int col) const { return cols[col][row]; }
+    mat4f invert_transpose() const; // closed form, see geometry.h
+};
+
+#if defined(SIMD_X86)
+inline float4 operator*(const mat4f &m, const float4 &v) {
+    const __m128 p = v.m128();
+    __m128 r =           _mm_mul_ps(m.cols[0].m128(), _mm_shuffle_ps(p, p, _MM_SHUFFLE(0,0,0,0)));
+    r = _mm_add_ps(r, _mm_mul_ps(m.cols[1].m128(), _mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1))));
+    r = _mm_add_ps(r, _mm_mul_ps(m.cols[2].m128(), _mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2))));
+    r = _mm_add_ps(r, _mm_mul_ps(m.cols[3].m128(), _mm_shuffle_ps(p, p, _MM_SHUFFLE(3,3,3,3))));
+    return float4(r);
+}
+#else
+inline float4 operator*(const mat4f &m, const float4 &v) {
+    return m.cols[0]*v.x + m.cols[1]*v.y + m.cols[2]*v.z + m.cols[3]*v.w;
+}
+#endif
+
+inline mat4f operator*(const mat4f &a, const mat4f &b) {
+    mat4f ret;
+    for (int j=4; j--; ret.cols[j] = a*b.cols[j]);
+    return ret;
+}
+
+#if defined(SIMD_X86)
+// geometry.h's formula on the columns: the cofactors of the transpose are the transposed cofactors, so its rows are our columns.
+// With a,b the first two columns and S1,S2,S3 their 2x2 minors (s5,s5,s4,s3), (s4,s2,s2,s1), (s3,s1,s0,s0), the cofactor column
+// of c is +-(c.yxxx*S1 - c.zzyy*S2 + c.wwwz*S3), and likewise for the other three columns.
+inline mat4f mat4f::invert_transpose() const {
+    const __m128 a = cols[0].m128(), b = cols[1].m128(), c = cols[2].m128(), d = cols[3].m128();
+    const auto yxxx = [](const __m128 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0,0,0,1)); };
+    const auto zzyy = [](const __m128 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,1,2,2)); };
+    const auto wwwz = [](const __m128 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2,3,3,3)); };
+    const auto minors = [](const __m128 u1, const __m128 u2, const __m128 v1, const __m128 v2) { // u1*v2 - v1*u2
+        return _mm_sub_ps(_mm_mul_ps(u1, v2), _mm_mul_ps(v1, u2));
+    };
+    const __m128 ay = yxxx(a), az = zzyy(a), aw = wwwz(a), by = yxxx(b), bz = zzyy(b), bw = wwwz(b);
+    const __m128 cy = yxxx(c), cz = zzyy(c), cw = wwwz(c), dy = yxxx(d), dz = zzyy(d), dw = wwwz(d);
+    const __m128 s1 = minors(az, aw, bz, bw), s2 = minors(ay, aw, by, bw), s3 = minors(ay, az, by, bz);
+    const __m128 c1 = minors(cz, cw, dz, dw), c2 = minors(cy, cw, dy, dw), c3 = minors(cy, cz, dy, dz);
+    const auto cofactors = [](const __m128 y, const __m128 z, const __m128 w, const __m128 m1, const __m128 m2, const __m128 m3) {
+        return _mm_add_ps(_mm_sub_ps(_mm_mul_ps(y, m1), _mm_mul_ps(z, m2)), _mm_mul_ps(w, m3));
+    };
+    const __m128 odd = _mm_set_ps(-0.f, 0.f, -0.f, 0.f), even = _mm_set_ps(0.f, -0.f, 0.f, -0.f); // sign patterns +-+- and -+-+
+    const __m128 ra = _mm_xor_ps(cofactors(by, bz, bw, c1, c2, c3), odd);
+    const __m128 rb = _mm_xor_ps(cofactors(ay, az, aw, c1, c2, c3), even);
+    const __m128 rc = _mm_xor_ps(cofactors(dy, dz, dw, s1, s2, s3), odd);
+    const __m128 rd = _mm_xor_ps(cofactors(cy, cz, cw, s1, s2, s3), even);
+    const __m128 inv = _mm_set1_ps(1.f/(float4(a)*float4(ra))); // determinant: first column dot its cofactors
+    mat4f ret;
+    ret.cols[0] = float4(_mm_mul_ps(ra, inv));
+    ret.cols[1] = float4(_mm_mul_ps(rb, inv));
+    ret.cols[2] = float4(_mm_mul_ps(rc, inv));
+    ret.cols[3] = float4(_mm_mul_ps(rd, inv));
+    return ret;
+}
+#else
+inline mat4f mat4f::invert_transpose() const {
+    mat<4,4,float> m;
+    for (int i=4; i--; )
+        for (int j=4; j--; m[i][j]=cols[j][i]);
+    const mat<4,4,float> it = m.invert_transpose();
+    mat4f ret;
+    for (int j=4; j--; )
+        ret.cols[j] = { it[0][j], it[1][j], it[2][j], it[3][j] };
+    return ret;
+}
+#endif
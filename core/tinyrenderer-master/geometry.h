@@ -3,185 +3,241 @@
 #include <cassert>
 #include <iostream>
 
-template<int n> struct vec {
-    double data[n] = {0};
-    double& operator[](const int i)       { assert(i>=0 && i<n); return data[i]; }
-    double  operator[](const int i) const { assert(i>=0 && i<n); return data[i]; }
+// The scalar type T is the precision of the templates below: double by default, float for the compact vertex storage and the SIMD paths (see fmath.h).
+template<typename T> struct nondeduced { typedef T type; }; // lets vec<n,float>*2. compile without a deduction conflict between float and double
+
+template<int n, typename T=double> struct vec {
+    T data[n] = {0};
+    T& operator[](const int i)       { assert(i>=0 && i<n); return data[i]; }
+    T  operator[](const int i) const { assert(i>=0 && i<n); return data[i]; }
 };
 
-template<int n> double operator*(const vec<n>& lhs, const vec<n>& rhs) {
-    double ret = 0;                         // N.B. Do not ever, ever use such for loops! They are highly confusing.
+template<int n, typename T> T operator*(const vec<n,T>& lhs, const vec<n,T>& rhs) {
+    T ret = 0;                              // N.B. Do not ever, ever use such for loops! They are highly confusing.
     for (int i=n; i--; ret+=lhs[i]*rhs[i]); // Here I used them as a tribute to old-school game programmers fighting for every CPU cycle.
     return ret;                             // Once upon a time reverse loops were faster than the normal ones, it is not the case anymore.
 }
 
-template<int n> vec<n> operator+(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n,T> operator+(const vec<n,T>& lhs, const vec<n,T>& rhs) {
+    vec<n,T> ret = lhs;
     for (int i=n; i--; ret[i]+=rhs[i]);
     return ret;
 }
 
-template<int n> vec<n> operator-(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n,T> operator-(const vec<n,T>& lhs, const vec<n,T>& rhs) {
+    vec<n,T> ret = lhs;
     for (int i=n; i--; ret[i]-=rhs[i]);
     return ret;
 }
 
-template<int n> vec<n> operator*(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n,T> operator*(const vec<n,T>& lhs, const typename nondeduced<T>::type& rhs) {
+    vec<n,T> ret = lhs;
     for (int i=n; i--; ret[i]*=rhs);
     return ret;
 }
 
-template<int n> vec<n> operator*(const double& lhs, const vec<n> &rhs) {
+template<int n, typename T> vec<n,T> operator*(const typename nondeduced<T>::type& lhs, const vec<n,T> &rhs) {
     return rhs * lhs;
 }
 
-template<int n> vec<n> operator/(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n,T> operator/(const vec<n,T>& lhs, const typename nondeduced<T>::type& rhs) {
+    vec<n,T> ret = lhs;
     for (int i=n; i--; ret[i]/=rhs);
     return ret;
 }
 
-template<int n> std::ostream& operator<<(std::ostream& out, const vec<n>& v) {
+template<int n, typename T> std::ostream& operator<<(std::ostream& out, const vec<n,T>& v) {
     for (int i=0; i<n; i++) out << v[i] << " ";
     return out;
 }
 
-template<> struct vec<2> {
-    double x = 0, y = 0;
-    double& operator[](const int i)       { assert(i>=0 && i<2); return i ? y : x; }
-    double  operator[](const int i) const { assert(i>=0 && i<2); return i ? y : x; }
+// named components; indexing goes through a table of member pointers instead of a chain of branches
+template<typename T> struct vec<2,T> {
+    T x = 0, y = 0;
+    T& operator[](const int i)       { assert(i>=0 && i<2); return this->*m[i]; }
+    T  operator[](const int i) const { assert(i>=0 && i<2); return this->*m[i]; }
+private:
+    static constexpr T vec::* m[2] = { &vec::x, &vec::y };
 };
 
-template<> struct vec<3> {
-    double x = 0, y = 0, z = 0;
-    double& operator[](const int i)       { assert(i>=0 && i<3); return i ? (1==i ? y : z) : x; }
-    double  operator[](const int i) const { assert(i>=0 && i<3); return i ? (1==i ? y : z) : x; }
+template<typename T> struct vec<3,T> {
+    T x = 0, y = 0, z = 0;
+    T& operator[](const int i)       { assert(i>=0 && i<3); return this->*m[i]; }
+    T  operator[](const int i) const { assert(i>=0 && i<3); return this->*m[i]; }
+private:
+    static constexpr T vec::* m[3] = { &vec::x, &vec::y, &vec::z };
 };
 
-template<> struct vec<4> {
-    double x = 0, y = 0, z = 0, w = 0;
-    double& operator[](const int i)       { assert(i>=0 && i<4); return i<2 ? (i ? y : x) : (2==i ? z : w); }
-    double  operator[](const int i) const { assert(i>=0 && i<4); return i<2 ? (i ? y : x) : (2==i ? z : w); }
-    vec<2> xy()  const { return {x, y};    }
-    vec<3> xyz() const { return {x, y, z}; }
+template<typename T> struct vec<4,T> {
+    T x = 0, y = 0, z = 0, w = 0;
+    T& operator[](const int i)       { assert(i>=0 && i<4); return this->*m[i]; }
+    T  operator[](const int i) const { assert(i>=0 && i<4); return this->*m[i]; }
+    vec<2,T> xy()  const { return {x, y};    }
+    vec<3,T> xyz() const { return {x, y, z}; }
+private:
+    static constexpr T vec::* m[4] = { &vec::x, &vec::y, &vec::z, &vec::w };
 };
 
 typedef vec<2> vec2;
 typedef vec<3> vec3;
 typedef vec<4> vec4;
+typedef vec<2,float> vec2f;
+typedef vec<3,float> vec3f;
+typedef vec<4,float> vec4f;
+
+template<typename U, int n, typename T> vec<n,U> vec_cast(const vec<n,T>& v) { // precision conversion
+    vec<n,U> ret;
+    for (int i=n; i--; ret[i]=static_cast<U>(v[i]));
+    return ret;
+}
 
-template<int n> double norm(const vec<n>& v) {
+template<int n, typename T> T norm(const vec<n,T>& v) {
     return std::sqrt(v*v);
 }
 
-template<int n> vec<n> normalized(const vec<n>& v) {
+template<int n, typename T> vec<n,T> normalized(const vec<n,T>& v) {
     return v / norm(v);
 }
 
-inline vec3 cross(const vec3 &v1, const vec3 &v2) {
+template<typename T> vec<3,T> cross(const vec<3,T> &v1, const vec<3,T> &v2) {
     return {v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x};
 }
 
-template<int n> struct dt;
+template<int n, typename T> struct dt;
 
-template<int nrows,int ncols> struct mat {
-    vec<ncols> rows[nrows] = {{}};
+template<int nrows,int ncols, typename T=double> struct mat {
+    vec<ncols,T> rows[nrows] = {{}};
 
-          vec<ncols>& operator[] (const int idx)       { assert(idx>=0 && idx<nrows); return rows[idx]; }
-    const vec<ncols>& operator[] (const int idx) const { assert(idx>=0 && idx<nrows); return rows[idx]; }
+          vec<ncols,T>& operator[] (const int idx)       { assert(idx>=0 && idx<nrows); return rows[idx]; }
+    const vec<ncols,T>& operator[] (const int idx) const { assert(idx>=0 && idx<nrows); return rows[idx]; }
 
-    double det() const {
-        return dt<ncols>::det(*this);
+    T det() const {
+        return dt<ncols,T>::det(*this);
     }
 
-    double cofactor(const int row, const int col) const {
-        mat<nrows-1,ncols-1> submatrix;
+    T cofactor(const int row, const int col) const {
+        mat<nrows-1,ncols-1,T> submatrix;
         for (int i=nrows-1; i--; )
             for (int j=ncols-1;j--; submatrix[i][j]=rows[i+int(i>=row)][j+int(j>=col)]);
         return submatrix.det() * ((row+col)%2 ? -1 : 1);
     }
 
-    mat<nrows,ncols> invert_transpose() const {
-        mat<nrows,ncols> adjugate_transpose; // transpose to ease determinant computation, check the last line
-        for (int i=nrows; i--; )
-            for (int j=ncols; j--; adjugate_transpose[i][j]=cofactor(i,j));
-        return adjugate_transpose/(adjugate_transpose[0]*rows[0]);
+    mat<nrows,ncols,T> invert_transpose() const {
+        if constexpr (nrows==3 && ncols==3) return invert_transpose3();
+        else if constexpr (nrows==4 && ncols==4) return invert_transpose4();
+        else {
+            mat<nrows,ncols,T> adjugate_transpose; // transpose to ease determinant computation, check the last line
+            for (int i=nrows; i--; )
+                for (int j=ncols; j--; adjugate_transpose[i][j]=cofactor(i,j));
+            return adjugate_transpose/(adjugate_transpose[0]*rows[0]);
+        }
     }
 
-    mat<nrows,ncols> invert() const {
+    mat<nrows,ncols,T> invert() const {
         return invert_transpose().transpose();
     }
 
-    mat<ncols,nrows> transpose() const {
-        mat<ncols,nrows> ret;
+    mat<ncols,nrows,T> transpose() const {
+        mat<ncols,nrows,T> ret;
         for (int i=ncols; i--; )
             for (int j=nrows; j--; ret[i][j]=rows[j][i]);
         return ret;
     }
+
+private:
+    mat<3,3,T> invert_transpose3() const { // closed form: the cofactor matrix divided by the determinant
+        const vec<3,T> &a = rows[0], &b = rows[1], &c = rows[2];
+        const vec<3,T> ca = cross(b, c), cb = cross(c, a), cc = cross(a, b);
+        return mat<3,3,T>{{ca, cb, cc}} / (a*ca);
+    }
+
+    mat<4,4,T> invert_transpose4() const { // closed form via the 2x2 sub-determinants of the top and bottom row pairs
+        const vec<4,T> &a = rows[0], &b = rows[1], &c = rows[2], &d = rows[3];
+        const T s0 = a.x*b.y - b.x*a.y, s1 = a.x*b.z - b.x*a.z, s2 = a.x*b.w - b.x*a.w;
+        const T s3 = a.y*b.z - b.y*a.z, s4 = a.y*b.w - b.y*a.w, s5 = a.z*b.w - b.z*a.w;
+        const T c5 = c.z*d.w - d.z*c.w, c4 = c.y*d.w - d.y*c.w, c3 = c.y*d.z - d.y*c.z;
+        const T c2 = c.x*d.w - d.x*c.w, c1 = c.x*d.z - d.x*c.z, c0 = c.x*d.y - d.x*c.y;
+        const T det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+        return mat<4,4,T>{{
+            { b.y*c5 - b.z*c4 + b.w*c3, -b.x*c5 + b.z*c2 - b.w*c1,  b.x*c4 - b.y*c2 + b.w*c0, -b.x*c3 + b.y*c1 - b.z*c0},
+            {-a.y*c5 + a.z*c4 - a.w*c3,  a.x*c5 - a.z*c2 + a.w*c1, -a.x*c4 + a.y*c2 - a.w*c0,  a.x*c3 - a.y*c1 + a.z*c0},
+            { d.y*s5 - d.z*s4 + d.w*s3, -d.x*s5 + d.z*s2 - d.w*s1,  d.x*s4 - d.y*s2 + d.w*s0, -d.x*s3 + d.y*s1 - d.z*s0},
+            {-c.y*s5 + c.z*s4 - c.w*s3,  c.x*s5 - c.z*s2 + c.w*s1, -c.x*s4 + c.y*s2 - c.w*s0,  c.x*s3 - c.y*s1 + c.z*s0}
+        }} / det;
+    }
 };
 
-template<int nrows,int ncols> vec<ncols> operator*(const vec<nrows>& lhs, const mat<nrows,ncols>& rhs) {
-    return (mat<1,nrows>{{lhs}}*rhs)[0];
+template<int nrows,int ncols, typename T> vec<ncols,T> operator*(const vec<nrows,T>& lhs, const mat<nrows,ncols,T>& rhs) {
+    return (mat<1,nrows,T>{{lhs}}*rhs)[0];
 }
 
-template<int nrows,int ncols> vec<nrows> operator*(const mat<nrows,ncols>& lhs, const vec<ncols>& rhs) {
-    vec<nrows> ret;
+template<int nrows,int ncols, typename T> vec<nrows,T> operator*(const mat<nrows,ncols,T>& lhs, const vec<ncols,T>& rhs) {
+    vec<nrows,T> ret;
     for (int i=nrows; i--; ret[i]=lhs[i]*rhs);
     return ret;
 }
 
-template<int R1,int C1,int C2>mat<R1,C2> operator*(const mat<R1,C1>& lhs, const mat<C1,C2>& rhs) {
-    mat<R1,C2> result;
+template<int R1,int C1,int C2, typename T>mat<R1,C2,T> operator*(const mat<R1,C1,T>& lhs, const mat<C1,C2,T>& rhs) {
+    mat<R1,C2,T> result;
     for (int i=R1; i--; )
         for (int j=C2; j--; )
             for (int k=C1; k--; result[i][j]+=lhs[i][k]*rhs[k][j]);
     return result;
 }
 
-template<int nrows,int ncols>mat<nrows,ncols> operator*(const mat<nrows,ncols>& lhs, const double& val) {
-    mat<nrows,ncols> result;
+template<int nrows,int ncols, typename T>mat<nrows,ncols,T> operator*(const mat<nrows,ncols,T>& lhs, const typename nondeduced<T>::type& val) {
+    mat<nrows,ncols,T> result;
     for (int i=nrows; i--; result[i] = lhs[i]*val);
     return result;
 }
 
-template<int nrows,int ncols>mat<nrows,ncols> operator/(const mat<nrows,ncols>& lhs, const double& val) {
-    mat<nrows,ncols> result;
+template<int nrows,int ncols, typename T>mat<nrows,ncols,T> operator/(const mat<nrows,ncols,T>& lhs, const typename nondeduced<T>::type& val) {
+    mat<nrows,ncols,T> result;
     for (int i=nrows; i--; result[i] = lhs[i]/val);
     return result;
 }
 
-template<int nrows,int ncols>mat<nrows,ncols> operator+(const mat<nrows,ncols>& lhs, const mat<nrows,ncols>& rhs) {
-    mat<nrows,ncols> result;
+template<int nrows,int ncols, typename T>mat<nrows,ncols,T> operator+(const mat<nrows,ncols,T>& lhs, const mat<nrows,ncols,T>& rhs) {
+    mat<nrows,ncols,T> result;
     for (int i=nrows; i--; )
         for (int j=ncols; j--; result[i][j]=lhs[i][j]+rhs[i][j]);
     return result;
 }
 
-template<int nrows,int ncols>mat<nrows,ncols> operator-(const mat<nrows,ncols>& lhs, const mat<nrows,ncols>& rhs) {
-    mat<nrows,ncols> result;
+template<int nrows,int ncols, typename T>mat<nrows,ncols,T> operator-(const mat<nrows,ncols,T>& lhs, const mat<nrows,ncols,T>& rhs) {
+    mat<nrows,ncols,T> result;
     for (int i=nrows; i--; )
         for (int j=ncols; j--; result[i][j]=lhs[i][j]-rhs[i][j]);
     return result;
 }
 
-template<int nrows,int ncols> std::ostream& operator<<(std::ostream& out, const mat<nrows,ncols>& m) {
+template<typename U, int nrows, int ncols, typename T> mat<nrows,ncols,U> mat_cast(const mat<nrows,ncols,T>& m) { // precision conversion
+    mat<nrows,ncols,U> ret;
+    for (int i=nrows; i--; ret[i]=vec_cast<U>(m[i]));
+    return ret;
+}
+
+template<int nrows,int ncols, typename T> std::ostream& operator<<(std::ostream& out, const mat<nrows,ncols,T>& m) {
     for (int i=0; i<nrows; i++) out << m[i] << std::endl;
     return out;
 }
 
-template<int n> struct dt { // template metaprogramming to compute the determinant recursively
-    static double det(const mat<n,n>& src) {
-        double ret = 0;
+template<int n, typename T> struct dt { // template metaprogramming to compute the determinant recursively
+    static T det(const mat<n,n,T>& src) {
+        T ret = 0;
         for (int i=n; i--; ret += src[0][i] * src.cofactor(0,i));
         return ret;
     }
 };
 
-template<> struct dt<1> {   // template specialization to stop the recursion
-    static double det(const mat<1,1>& src) {
-        return src[0][0];
+template<typename T> struct dt<3,T> { // closed form, it is the one computed per pixel by rasterize_reference()
+    static T det(const mat<3,3,T>& src) {
+        return src[0] * cross(src[1], src[2]);
     }
 };
 
+template<typename T> struct dt<1,T> { // template specialization to stop the recursion
+    static T det(const mat<1,1,T>& src) {
+        return src[0][0];
+    }
+};
@@ -0,0 +1,75 @@
+#include "mapped_file.h"
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string filename) {
+    open(filename);
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#if defined(_WIN32)
+bool MappedFile::open(const std::string filename) {
+    close();
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file==INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!ptr) {
+        close();
+        return false;
+    }
+    len = static_cast<std::size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (ptr)     UnmapViewOfFile(ptr);
+    if (mapping) CloseHandle(mapping);
+    if (file)    CloseHandle(file);
+    ptr = nullptr;
+    mapping = file = nullptr;
+    len = 0;
+}
+#else
+bool MappedFile::open(const std::string filename) {
+    close();
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd<0) return false;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size<=0) {
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (p==MAP_FAILED) return false;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    ptr = static_cast<const char*>(p);
+    len = st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (ptr) munmap(const_cast<char*>(ptr), len);
+    ptr = nullptr;
+    len = 0;
+}
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+class MappedFile { // read-only view of a whole file, mapped in memory: no copy, pages are read on first access
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool open(const std::string filename); // closes the previous file, false if the file cannot be read (an empty file is not mapped either)
+    void close();
+    const char* data() const { return ptr; }
+    std::size_t size() const { return len; }
+private:
+    const char *ptr = nullptr;
+    std::size_t len = 0;
+#if defined(_WIN32)
+    void *file = nullptr, *mapping = nullptr; // HANDLEs, windows.h stays out of the header
+#endif
+};
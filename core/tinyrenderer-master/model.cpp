@@ -1,82 +1,586 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <fstream>
-#include <sstream>
+#include <numeric>
+#include <queue>
 #include "model.h"
+#include "mapped_file.h"
+#include "threadpool.h"
 
-Model::Model(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            vec4 v = {0,0,0,1};
-            for (int i : {0,1,2}) iss >> v[i];
-            verts.push_back(v);
-        } else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            vec4 n;
-            for (int i : {0,1,2}) iss >> n[i];
-            norms.push_back(normalized(n));
-        } else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            vec2 uv;
-            for (int i : {0,1}) iss >> uv[i];
-            tex.push_back({uv.x, 1-uv.y});
-        } else if (!line.compare(0, 2, "f ")) {
-            int f,t,n, cnt = 0;
-            iss >> trash;
-            while (iss >> f >> trash >> t >> trash >> n) {
-                facet_vrt.push_back(--f);
-                facet_tex.push_back(--t);
-                facet_nrm.push_back(--n);
-                cnt++;
-            }
-            if (3!=cnt) {
-                std::cerr << "Error: the obj file is supposed to be triangulated" << std::endl;
-                return;
+// .obj parsing straight from the mapped file. A first pass counts the entries of every chunk of lines,
+// so that the second one writes them in place at their final offsets: both passes run in parallel on large files.
+namespace {
+    struct ObjCounts { int v = 0, vn = 0, vt = 0, f = 0; };
+
+    const char* next_line(const char *p, const char *end) {
+        p = static_cast<const char*>(std::memchr(p, '\n', end-p));
+        return p ? p+1 : end;
+    }
+
+    bool is_blank(const char c) {
+        return c==' ' || c=='\t';
+    }
+
+    const char* skip_blanks(const char *p, const char *end) {
+        while (p<end && is_blank(*p)) p++;
+        return p;
+    }
+
+    int line_kind(const char *p, const char *end) { // 'v', 'n' (vn), 't' (vt), 'f', or 0 for the lines we do not care about
+        if (end-p<2) return 0;
+        if (p[0]=='f' && is_blank(p[1])) return 'f';
+        if (p[0]!='v') return 0;
+        if (is_blank(p[1])) return 'v';
+        if (end-p>2 && is_blank(p[2]) && (p[1]=='n' || p[1]=='t')) return p[1];
+        return 0;
+    }
+
+    // One pool for all the loads: concurrent ones (AssetLoader workers) do not spawn a thread per core each.
+    // A load that finds it taken parses on its own thread, the loads themselves already run side by side.
+    struct ObjPool {
+        ThreadPool pool;
+        std::mutex mutex;
+    };
+
+    ObjPool& obj_pool() { // started on the first load, never destroyed: a load may still run on a loader thread at exit
+        static ObjPool *shared = new ObjPool();
+        return *shared;
+    }
+
+    template<typename T> bool parse_number(const char *&p, const char *end, T &value) {
+        p = skip_blanks(p, end);
+        const auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec!=std::errc()) return false;
+        p = ptr;
+        return true;
+    }
+}
+
+bool Model::load_obj(const MappedFile &file, Mesh &mesh) {
+    if (!file.data()) return false;
+    const char *begin = file.data(), *end = begin + file.size();
+
+    constexpr std::size_t chunk_bytes = 1<<20;                 // below that, threads cost more than they bring
+    ObjPool &shared = obj_pool();
+    std::unique_lock<std::mutex> owner(shared.mutex, std::try_to_lock);
+    const int nchunks = owner.owns_lock() ? std::min<std::size_t>(shared.pool.size(), 1 + file.size()/chunk_bytes) : 1;
+    std::vector<const char*> bounds(nchunks+1, end);           // chunk i is [bounds[i], bounds[i+1]), cut right after a line break
+    bounds[0] = begin;
+    for (int i=1; i<nchunks; i++)
+        bounds[i] = next_line(std::max(bounds[i-1], begin + file.size()*i/nchunks), end);
+
+    ThreadPool &pool = shared.pool;                            // a single chunk runs on the calling thread, the pool is not touched
+    std::vector<ObjCounts> counts(nchunks+1);                  // pass 1, then counts[i] is the offset of chunk i
+    pool.parallel_for(nchunks, [&](const int chunk) {
+        ObjCounts &c = counts[chunk+1];
+        for (const char *p = bounds[chunk]; p<bounds[chunk+1]; p = next_line(p, bounds[chunk+1])) {
+            const int kind = line_kind(p, bounds[chunk+1]);
+            c.v  += kind=='v';
+            c.vn += kind=='n';
+            c.vt += kind=='t';
+            c.f  += kind=='f';
+        }
+    });
+    for (int i=0; i<nchunks; i++) {
+        counts[i+1].v  += counts[i].v;
+        counts[i+1].vn += counts[i].vn;
+        counts[i+1].vt += counts[i].vt;
+        counts[i+1].f  += counts[i].f;
+    }
+    const ObjCounts &total = counts[nchunks];
+    for (int i : {0,1,2}) {
+        mesh.verts[i].resize(total.v);
+        mesh.norms[i].resize(total.vn);
+    }
+    for (int i : {0,1}) mesh.tex[i].resize(total.vt);
+    for (std::vector<int> *v : {&mesh.facet_vrt, &mesh.facet_tex, &mesh.facet_nrm}) v->resize(total.f*3);
+
+    std::vector<std::uint8_t> ok(nchunks, 1);                  // pass 2
+    pool.parallel_for(nchunks, [&](const int chunk) {
+        ObjCounts c = counts[chunk];
+        const char *stop = bounds[chunk+1];
+        for (const char *p = bounds[chunk]; p<stop; p = next_line(p, stop)) {
+            const int kind = line_kind(p, stop);
+            if (!kind) continue;
+            const char *q = p + (kind=='v' || kind=='f' ? 1 : 2);
+            if (kind=='v' || kind=='n') {
+                vec3 v;
+                for (int i : {0,1,2}) parse_number(q, stop, v[i]);
+                if (kind=='n') v = normalized(v);
+                std::vector<real> *dst = kind=='v' ? mesh.verts : mesh.norms;
+                const int index = kind=='v' ? c.v++ : c.vn++;
+                for (int i : {0,1,2}) dst[i][index] = v[i];
+            } else if (kind=='t') {
+                vec2 uv;
+                for (int i : {0,1}) parse_number(q, stop, uv[i]);
+                mesh.tex[0][c.vt] = uv.x;
+                mesh.tex[1][c.vt] = 1-uv.y;
+                c.vt++;
+            } else {
+                int cnt = 0, f, t, n;
+                while (parse_number(q, stop, f) && q<stop && *q++=='/' && parse_number(q, stop, t) && q<stop && *q++=='/' && parse_number(q, stop, n)) {
+                    if (cnt<3) {
+                        mesh.facet_vrt[c.f*3+cnt] = f-1;
+                        mesh.facet_tex[c.f*3+cnt] = t-1;
+                        mesh.facet_nrm[c.f*3+cnt] = n-1;
+                    }
+                    cnt++;
+                }
+                c.f++;
+                if (3!=cnt) {
+                    ok[chunk] = 0;
+                    return;
+                }
             }
         }
+    });
+    if (std::find(ok.begin(), ok.end(), 0)!=ok.end()) {
+        std::cerr << "Error: the obj file is supposed to be triangulated" << std::endl;
+        mesh = Mesh();
+        return false;
+    }
+    return true;
+}
+
+Model::Model(const std::string filename, const bool use_cache, const bool textures) {
+    const MappedFile obj(filename);
+    const std::uint64_t hash = obj.data() ? content_hash(obj.data(), obj.size()) : 0;
+    if (!use_cache || !obj.data() || !read_cache(filename + ".mesh", hash)) {
+        Mesh &mesh = lods.emplace_back();
+        const bool ok = load_obj(obj, mesh);
+        build_views();
+        if (!ok) return;
+        std::cerr << "# v# " << nverts() << " f# "  << nfaces() << std::endl;
+        optimize();
+        build_views();
+        if (nverts()) {                 // centered on the bounding box, not the tightest sphere but a cheap and good enough one
+            const Mesh &m = lods[0];
+            vec3 lo = vert(0).xyz(), hi = lo;
+            for (int i=nverts(); i--; )
+                for (int j : {0,1,2}) {
+                    lo[j] = std::min<double>(lo[j], m.verts[j][i]);
+                    hi[j] = std::max<double>(hi[j], m.verts[j][i]);
+                }
+            center = (lo + hi) / 2.;
+            for (int i=nverts(); i--; )
+                radius = std::max(radius, norm(vert(i).xyz() - center));
+        }
+        build_lods();
+        build_views();
+        if (use_cache) write_cache(filename + ".mesh", hash);
+    } else std::cerr << "# v# " << nverts() << " f# "  << nfaces() << " from " << filename << ".mesh" << std::endl;
+    std::cerr << "# lod f#";
+    for (const MeshView &v : views) std::cerr << " " << v.nfaces;
+    std::cerr << std::endl;
+    if (!textures) return;
+    for (const Map map : {DIFFUSE, NORMAL, SPECULAR})
+        set_map(map, load_map(filename, map));
+}
+
+// Garland-Heckbert simplification restricted to half-edge collapses: a vertex is merged into one of its neighbors,
+// so every level of detail is a subset of the vertices of the previous one and the triangle corners keep their uv and normal.
+// One run of collapses goes down to the coarsest level, the levels in between are snapshots taken on the way.
+void Model::build_lods() {
+    constexpr int min_faces = 256;     // no level of detail with less triangles than that
+    const Mesh &full = lods[0];
+    const int nv = full.verts[0].size(), nf = full.facet_vrt.size()/3;
+    if (nf < 2*min_faces) return;
+
+    std::vector<vec3> p(nv);
+    for (int i=nv; i--; p[i] = {full.verts[0][i], full.verts[1][i], full.verts[2][i]});
+    std::vector<int> fv = full.facet_vrt;              // triangle corners, updated by the collapses
+    std::vector<char> alive(nf, 1), removed(nv, 0);
+    std::vector<std::vector<int>> vfaces(nv);          // triangles around every vertex, dead ones are pruned lazily
+    for (int f=0; f<nf; f++)
+        for (int k : {0,1,2}) vfaces[fv[f*3+k]].push_back(f);
+
+    std::vector<mat<4,4>> q(nv);                       // error quadrics: sum of squared distances to the planes around the vertex
+    auto add_plane = [&](const int v, const vec3 &n, const double d, const double weight) {
+        const vec4 plane = {n.x, n.y, n.z, d};
+        for (int i=4; i--; )
+            for (int j=4; j--; q[v][i][j] += weight*plane[i]*plane[j]);
+    };
+    std::vector<std::pair<int,int>> edges;             // directed edges, a boundary edge has no opposite twin
+    for (int f=0; f<nf; f++) {
+        const vec3 &a = p[fv[f*3]], &b = p[fv[f*3+1]], &c = p[fv[f*3+2]];
+        const vec3 n = cross(b-a, c-a);
+        const double area = norm(n);
+        if (area<=0) continue;
+        for (int k : {0,1,2}) {
+            add_plane(fv[f*3+k], n/area, -(n*a)/area, area);
+            edges.push_back({fv[f*3+k], fv[f*3+(k+1)%3]});
+        }
     }
-    std::cerr << "# v# " << nverts() << " f# "  << nfaces() << std::endl;
-    auto load_texture = [&filename](const std::string suffix, TGAImage &img) {
-        size_t dot = filename.find_last_of(".");
-        if (dot==std::string::npos) return;
-        std::string texfile = filename.substr(0,dot) + suffix;
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
+    std::sort(edges.begin(), edges.end());
+    for (const auto &[u, v] : edges) {                  // pin the open borders with planes orthogonal to them
+        if (std::binary_search(edges.begin(), edges.end(), std::make_pair(v, u))) continue;
+        for (const int f : vfaces[u]) {
+            int k = 0;
+            while (k<3 && !(fv[f*3+k]==u && fv[f*3+(k+1)%3]==v)) k++;
+            if (k==3) continue;
+            const vec3 &a = p[fv[f*3]], &b = p[fv[f*3+1]], &c = p[fv[f*3+2]];
+            const vec3 e = p[v]-p[u], side = cross(e, cross(b-a, c-a));
+            if (norm(side)<=0) break;
+            const vec3 n = normalized(side);
+            for (const int w : {u, v}) add_plane(w, n, -(n*p[u]), 1e3*(e*e));
+            break;
+        }
+    }
+
+    auto error = [&](const mat<4,4> &m, const vec3 &v) { const vec4 h = {v.x, v.y, v.z, 1}; return (m*h)*h; };
+    struct Collapse { double cost; int from, to, stamp_from, stamp_to; bool operator>(const Collapse &c) const { return cost > c.cost; } };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    std::vector<int> stamp(nv, 0);                     // bumped when the quadric or the neighborhood of a vertex changes
+    auto candidate = [&](const int a, const int b) {
+        const mat<4,4> m = q[a] + q[b];
+        const double ea = error(m, p[a]), eb = error(m, p[b]);
+        if (ea<eb) heap.push({ea, b, a, stamp[b], stamp[a]});
+        else       heap.push({eb, a, b, stamp[a], stamp[b]});
+    };
+    for (const auto &[u, v] : edges)
+        if (u<v || !std::binary_search(edges.begin(), edges.end(), std::make_pair(v, u))) candidate(u, v);
+
+    auto neighbors = [&](const int v, std::vector<int> &out) {
+        out.clear();
+        for (const int f : vfaces[v])
+            for (int k : {0,1,2})
+                if (alive[f] && fv[f*3+k]!=v) out.push_back(fv[f*3+k]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    auto valid = [&](const int u, const int v, const std::vector<int> &nu, const std::vector<int> &nw) {
+        int shared = 0, common = 0;                    // link condition: no other common neighbor than the opposite corners,
+        for (const int f : vfaces[u])                  // otherwise the collapse pinches the surface
+            if (alive[f] && (fv[f*3]==v || fv[f*3+1]==v || fv[f*3+2]==v)) shared++;
+        for (int i=0, j=0; i<(int)nu.size() && j<(int)nw.size(); ) {
+            if (nu[i]<nw[j]) i++; else if (nw[j]<nu[i]) j++; else { common++; i++; j++; }
+        }
+        if (common>shared) return false;
+        for (const int f : vfaces[u]) {                // no triangle may flip
+            if (!alive[f] || fv[f*3]==v || fv[f*3+1]==v || fv[f*3+2]==v) continue;
+            vec3 c[3] = { p[fv[f*3]], p[fv[f*3+1]], p[fv[f*3+2]] };
+            const vec3 before = cross(c[1]-c[0], c[2]-c[0]);
+            for (int k : {0,1,2}) if (fv[f*3+k]==u) c[k] = p[v];
+            if (before*cross(c[1]-c[0], c[2]-c[0]) <= 0) return false;
+        }
+        return true;
     };
-    load_texture("_diffuse.tga",    diffusemap );
-    load_texture("_nm_tangent.tga", normalmap);
-    load_texture("_spec.tga",       specularmap);
+
+    std::vector<Mesh> chain;
+    auto snapshot = [&]() { chain.push_back(compact(full, fv, alive)); }; // the surviving triangles make a new level
+
+    int faces = nf, target = nf/2;
+    std::vector<int> nu, nw;
+    while (!heap.empty() && target>=min_faces) {
+        const Collapse c = heap.top();
+        heap.pop();
+        const int u = c.from, v = c.to;
+        if (removed[u] || removed[v] || stamp[u]!=c.stamp_from || stamp[v]!=c.stamp_to) continue; // outdated entry
+        neighbors(u, nu);
+        neighbors(v, nw);
+        if (!valid(u, v, nu, nw)) continue;
+        for (const int f : vfaces[u]) {
+            if (!alive[f]) continue;
+            if (fv[f*3]==v || fv[f*3+1]==v || fv[f*3+2]==v) { alive[f] = 0; faces--; continue; } // the triangles along the edge vanish
+            for (int k : {0,1,2}) if (fv[f*3+k]==u) fv[f*3+k] = v;
+            vfaces[v].push_back(f);
+        }
+        removed[u] = 1;
+        q[v] = q[v] + q[u];
+        stamp[v]++;
+        vfaces[v].erase(std::remove_if(vfaces[v].begin(), vfaces[v].end(), [&](const int f) { return !alive[f]; }), vfaces[v].end());
+        neighbors(v, nw);
+        for (const int w : nw) candidate(v, w);       // only the edges around v have a new cost
+        if (faces<=target) {
+            snapshot();
+            target = faces/2;
+        }
+    }
+    for (Mesh &m : chain) lods.push_back(std::move(m));
 }
 
-int Model::nverts() const { return verts.size(); }
-int Model::nfaces() const { return facet_vrt.size()/3; }
+// Merges the entries of the attribute arrays holding the same values and compacts the result: .obj exporters
+// often repeat vertices along the seams, and the order of first use keeps the vertex fetches of neighboring triangles close.
+namespace {
+    template<int n> std::vector<int> first_duplicate(const std::vector<float> (&a)[n]) { // index of the first entry equal to entry i
+        std::vector<int> order(a[0].size()), ret(a[0].size());
+        std::iota(order.begin(), order.end(), 0);
+        auto less = [&](const int i, const int j) {
+            for (int k=0; k<n; k++) if (a[k][i]!=a[k][j]) return a[k][i]<a[k][j];
+            return false;
+        };
+        std::stable_sort(order.begin(), order.end(), less);
+        for (int i=0, first=0; i<(int)order.size(); i++) {
+            if (i && less(order[i-1], order[i])) first = i;
+            ret[order[i]] = order[first];
+        }
+        return ret;
+    }
+}
 
-vec4 Model::vert(const int i) const {
-    return verts[i];
+void Model::optimize() {
+    Mesh &m = lods[0];
+    const std::vector<int> vmap = first_duplicate(m.verts), nmap = first_duplicate(m.norms), tmap = first_duplicate(m.tex);
+    for (int i=m.facet_vrt.size(); i--; ) {
+        m.facet_vrt[i] = vmap[m.facet_vrt[i]];
+        m.facet_nrm[i] = nmap[m.facet_nrm[i]];
+        m.facet_tex[i] = tmap[m.facet_tex[i]];
+    }
+    lods[0] = compact(m, m.facet_vrt, std::vector<char>(m.facet_vrt.size()/3, 1));
 }
 
-vec4 Model::vert(const int iface, const int nthvert) const {
-    return verts[facet_vrt[iface*3+nthvert]];
+Model::Mesh Model::compact(const Mesh &full, const std::vector<int> &fv, const std::vector<char> &alive) {
+    Mesh m;
+    std::vector<int> vmap(full.verts[0].size(), -1), nmap(full.norms[0].size(), -1), tmap(full.tex[0].size(), -1);
+    for (int f=0; f<(int)alive.size(); f++) {
+        if (!alive[f]) continue;
+        for (int k : {0,1,2}) {
+            const int i = fv[f*3+k], n = full.facet_nrm[f*3+k], t = full.facet_tex[f*3+k];
+            if (vmap[i]<0) { vmap[i] = m.verts[0].size(); for (int j : {0,1,2}) m.verts[j].push_back(full.verts[j][i]); }
+            if (nmap[n]<0) { nmap[n] = m.norms[0].size(); for (int j : {0,1,2}) m.norms[j].push_back(full.norms[j][n]); }
+            if (tmap[t]<0) { tmap[t] = m.tex[0].size();   for (int j : {0,1})   m.tex[j].push_back(full.tex[j][t]); }
+            m.facet_vrt.push_back(vmap[i]);
+            m.facet_nrm.push_back(nmap[n]);
+            m.facet_tex.push_back(tmap[t]);
+        }
+    }
+    return m;
 }
 
-vec4 Model::normal(const int iface, const int nthvert) const {
-    return norms[facet_nrm[iface*3+nthvert]];
+void Model::build_views() {
+    views.resize(lods.size());
+    for (int l=lods.size(); l--; ) {
+        const Mesh &m = lods[l];
+        MeshView &v = views[l];
+        for (int j : {0,1,2}) { v.verts[j] = m.verts[j].data(); v.norms[j] = m.norms[j].data(); }
+        for (int j : {0,1})   v.tex[j] = m.tex[j].data();
+        v.facet_vrt = m.facet_vrt.data();
+        v.facet_nrm = m.facet_nrm.data();
+        v.facet_tex = m.facet_tex.data();
+        v.nverts = m.verts[0].size();
+        v.nnorms = m.norms[0].size();
+        v.ntex   = m.tex[0].size();
+        v.nfaces = m.facet_vrt.size()/3;
+    }
+}
+
+// Compiled mesh file: a header, a table with one entry per level of detail, then the arrays of the levels,
+// every one starting on a cache line. It is mapped as is, the views point straight into it.
+namespace {
+    constexpr char cache_magic[4] = {'T','R','M','C'};
+    constexpr std::uint32_t cache_version = 1;
+    constexpr std::uint64_t cache_align = 64;
+
+    struct CacheHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t source_hash;          // content_hash() of the .obj
+        std::uint32_t nlods, real_size;     // real_size: bytes per coordinate
+        double center[3], radius;           // bounding sphere
+    };
+
+    struct CacheLevel {
+        std::uint32_t nverts, nnorms, ntex, nfaces;
+        std::uint64_t offset[11];           // from the start of the file: verts[3], norms[3], tex[2], facet_vrt, facet_nrm, facet_tex
+    };
+}
+
+std::uint64_t Model::content_hash(const char *data, const std::size_t size) { // FNV-1a, 64 bits
+    std::uint64_t h = 14695981039346656037ull;
+    for (std::size_t i=0; i<size; i++) h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    return h;
+}
+
+bool Model::read_cache(const std::string filename, const std::uint64_t hash) {
+    if (!cache.open(filename)) return false;
+    const char *base = cache.data();
+    const std::uint64_t size = cache.size();
+    auto reject = [this]() { views.clear(); cache.close(); return false; }; // stale, truncated or foreign file: it gets rebuilt
+    CacheHeader h;
+    if (size<sizeof(h)) return reject();
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic, cache_magic, 4) || h.version!=cache_version || h.source_hash!=hash || h.real_size!=sizeof(real) ||
+        !h.nlods || h.nlods>64 || size<sizeof(h) + h.nlods*sizeof(CacheLevel))
+        return reject();
+    views.resize(h.nlods);
+    for (std::uint32_t l=0; l<h.nlods; l++) {
+        CacheLevel c;
+        std::memcpy(&c, base + sizeof(h) + l*sizeof(c), sizeof(c));
+        const std::uint64_t count[11] = { c.nverts, c.nverts, c.nverts, c.nnorms, c.nnorms, c.nnorms, c.ntex, c.ntex, 3ull*c.nfaces, 3ull*c.nfaces, 3ull*c.nfaces };
+        for (int i=0; i<11; i++)
+            if (c.offset[i]%cache_align || c.offset[i]>size || count[i]*4>size-c.offset[i]) return reject();
+        MeshView &v = views[l];
+        for (int j : {0,1,2}) {
+            v.verts[j] = reinterpret_cast<const real*>(base + c.offset[j]);
+            v.norms[j] = reinterpret_cast<const real*>(base + c.offset[3+j]);
+        }
+        for (int j : {0,1}) v.tex[j] = reinterpret_cast<const real*>(base + c.offset[6+j]);
+        v.facet_vrt = reinterpret_cast<const int*>(base + c.offset[8]);
+        v.facet_nrm = reinterpret_cast<const int*>(base + c.offset[9]);
+        v.facet_tex = reinterpret_cast<const int*>(base + c.offset[10]);
+        auto in_range = [&c](const int *index, const std::uint32_t n) { // the hash covers the .obj only, not what was written here
+            for (std::uint64_t i=0; i<3ull*c.nfaces; i++)
+                if (index[i]<0 || static_cast<std::uint32_t>(index[i])>=n) return false;
+            return true;
+        };
+        if (!in_range(v.facet_vrt, c.nverts) || !in_range(v.facet_nrm, c.nnorms) || !in_range(v.facet_tex, c.ntex)) return reject();
+        v.nverts = c.nverts;
+        v.nnorms = c.nnorms;
+        v.ntex   = c.ntex;
+        v.nfaces = c.nfaces;
+    }
+    center = {h.center[0], h.center[1], h.center[2]};
+    radius = h.radius;
+    return true;
 }
 
-vec4 Model::normal(const vec2 &uv) const {
+void Model::write_cache(const std::string filename, const std::uint64_t hash) {
+    if (!nfaces()) return;
+    CacheHeader h = {};
+    std::memcpy(h.magic, cache_magic, 4);
+    h.version     = cache_version;
+    h.source_hash = hash;
+    h.nlods       = views.size();
+    h.real_size   = sizeof(real);
+    for (int j : {0,1,2}) h.center[j] = center[j];
+    h.radius      = radius;
+
+    auto align = [](const std::uint64_t offset) { return (offset + cache_align-1) / cache_align * cache_align; };
+    std::vector<CacheLevel> table(views.size());
+    std::vector<std::pair<const void*, std::uint64_t>> arrays;      // in file order
+    std::uint64_t offset = align(sizeof(h) + table.size()*sizeof(CacheLevel));
+    for (int l=0; l<(int)views.size(); l++) {
+        const MeshView &v = views[l];
+        CacheLevel &c = table[l];
+        c = { (std::uint32_t)v.nverts, (std::uint32_t)v.nnorms, (std::uint32_t)v.ntex, (std::uint32_t)v.nfaces, {} };
+        const void *data[11] = { v.verts[0], v.verts[1], v.verts[2], v.norms[0], v.norms[1], v.norms[2], v.tex[0], v.tex[1], v.facet_vrt, v.facet_nrm, v.facet_tex };
+        const std::uint64_t bytes[11] = { v.nverts*sizeof(real), v.nverts*sizeof(real), v.nverts*sizeof(real), v.nnorms*sizeof(real), v.nnorms*sizeof(real), v.nnorms*sizeof(real),
+                                          v.ntex*sizeof(real), v.ntex*sizeof(real), v.nfaces*3*sizeof(int), v.nfaces*3*sizeof(int), v.nfaces*3*sizeof(int) };
+        for (int i=0; i<11; i++) {
+            c.offset[i] = offset;
+            arrays.push_back({data[i], bytes[i]});
+            offset = align(offset + bytes[i]);
+        }
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) return;                   // read-only location: no cache, nothing else changes
+    const char zeros[cache_align] = {};
+    std::uint64_t written = 0;
+    auto put = [&](const void *data, const std::uint64_t bytes) {
+        out.write(zeros, align(written) - written);             // padding up to the next cache line
+        written = align(written);
+        out.write(static_cast<const char*>(data), bytes);
+        written += bytes;
+    };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof(CacheLevel));
+    written = sizeof(h) + table.size()*sizeof(CacheLevel);
+    for (const auto &[data, bytes] : arrays) put(data, bytes);
+    out.close();
+    if (!out) std::remove(filename.c_str()); // a truncated file would be rejected anyway, do not leave it behind
+}
+
+int Model::nlods() const { return views.size(); }
+int Model::lod()   const { return level; }
+
+void Model::select_lod(const int lod) {
+    level = std::clamp(lod, 0, nlods()-1);
+}
+
+int Model::lod_for_area(const double area) const {
+    int lod = 0;                       // half of the triangles face away, hence two triangles per pixel of the silhouette
+    while (lod+1<nlods() && views[lod+1].nfaces >= 2*area) lod++;
+    return lod;
+}
+
+template<typename T> std::pair<vec<3,T>,T> Model::bounding_sphere() const {
+    return {vec_cast<T>(center), T(radius)};
+}
+
+int Model::nverts()   const { return views[level].nverts; }
+int Model::nnormals() const { return views[level].nnorms; }
+int Model::nfaces()   const { return views[level].nfaces; }
+
+template<typename T> vec<4,T> Model::vert(const int i) const {
+    const MeshView &m = views[level];
+    return {T(m.verts[0][i]), T(m.verts[1][i]), T(m.verts[2][i]), 1};
+}
+
+template<typename T> vec<4,T> Model::normal(const int i) const {
+    const MeshView &m = views[level];
+    return {T(m.norms[0][i]), T(m.norms[1][i]), T(m.norms[2][i]), 0};
+}
+
+const float* Model::vert_data(const int axis) const {
+    return views[level].verts[axis];
+}
+
+const float* Model::normal_data(const int axis) const {
+    return views[level].norms[axis];
+}
+
+int Model::vert_index(const int iface, const int nthvert) const {
+    return views[level].facet_vrt[iface*3+nthvert];
+}
+
+int Model::normal_index(const int iface, const int nthvert) const {
+    return views[level].facet_nrm[iface*3+nthvert];
+}
+
+int Model::uv_index(const int iface, const int nthvert) const {
+    return views[level].facet_tex[iface*3+nthvert];
+}
+
+template<typename T> vec<4,T> Model::vert(const int iface, const int nthvert) const {
+    return vert<T>(views[level].facet_vrt[iface*3+nthvert]);
+}
+
+template<typename T> vec<4,T> Model::normal(const int iface, const int nthvert) const {
+    return normal<T>(views[level].facet_nrm[iface*3+nthvert]);
+}
+
+template<typename T> vec<4,T> Model::normal(const vec<2,T> &uv) const {
     TGAColor c = normalmap.get(uv[0]*normalmap.width(), uv[1]*normalmap.height());
-    return normalized(vec4{(double)c[2],(double)c[1],(double)c[0],0}*2./255. - vec4{1,1,1,0});
+    return normalized(vec<4,T>{(T)c[2],(T)c[1],(T)c[0],0}*T(2./255.) - vec<4,T>{1,1,1,0});
+}
+
+template<typename T> vec<2,T> Model::uv(const int iface, const int nthvert) const {
+    const MeshView &m = views[level];
+    const int i = m.facet_tex[iface*3+nthvert];
+    return {T(m.tex[0][i]), T(m.tex[1][i])};
+}
+
+
+Texture Model::load_map(const std::string filename, const Map map) {
+    static const char *suffix[] = {"_diffuse.tga", "_nm_tangent.tga", "_spec.tga"};
+    size_t dot = filename.find_last_of(".");
+    if (dot==std::string::npos) return {};
+    std::string texfile = filename.substr(0,dot) + suffix[map];
+    TGAImage img;
+    const bool ok = img.read_tga_file(texfile.c_str());
+    std::cerr << "texture file " << texfile << " loading " << (ok ? "ok" : "failed") << std::endl;
+    if (!ok) return {};
+    img.generate_mipmaps();
+    return Texture(img);
 }
 
-vec2 Model::uv(const int iface, const int nthvert) const {
-    return tex[facet_tex[iface*3+nthvert]];
+void Model::set_map(const Map map, Texture tex) {
+    (map==DIFFUSE ? diffusemap : map==NORMAL ? normalmap : specularmap) = std::move(tex);
 }
 
-const TGAImage& Model::diffuse()  const { return diffusemap;  }
-const TGAImage& Model::specular() const { return specularmap; }
+const Texture& Model::diffuse()  const { return diffusemap;  }
+const Texture& Model::specular() const { return specularmap; }
 
+// The two precisions of the geometry stage, see our_gl.h
+#define MODEL_INSTANTIATE(T) \
+    template vec<4,T> Model::vert<T>(const int) const; \
+    template vec<4,T> Model::normal<T>(const int) const; \
+    template vec<4,T> Model::vert<T>(const int, const int) const; \
+    template vec<4,T> Model::normal<T>(const int, const int) const; \
+    template vec<4,T> Model::normal<T>(const vec<2,T>&) const; \
+    template vec<2,T> Model::uv<T>(const int, const int) const; \
+    template std::pair<vec<3,T>,T> Model::bounding_sphere<T>() const;
+MODEL_INSTANTIATE(double)
+MODEL_INSTANTIATE(float)
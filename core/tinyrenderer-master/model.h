@@ -1,27 +1,68 @@
+#pragma once
 #include "geometry.h"
 #include "tgaimage.h"
+#include "texture.h"
+#include "mapped_file.h"
 
 class Model {
-    std::vector<vec4> verts = {};    // array of vertices        ┐ generally speaking, these arrays
-    std::vector<vec4> norms = {};    // array of normal vectors  │ do not have the same size
-    std::vector<vec2> tex = {};      // array of tex coords      ┘ check the logs of the Model() constructor
-    std::vector<int> facet_vrt = {}; //  ┐ per-triangle indices in the above arrays,
-    std::vector<int> facet_nrm = {}; //  │ the size is supposed to be
-    std::vector<int> facet_tex = {}; //  ┘ nfaces()*3
-    TGAImage diffusemap  = {};       // diffuse color texture
-    TGAImage normalmap   = {};       // normal map texture
-    TGAImage specularmap = {};       // specular texture
+    typedef float real;                   // storage precision of the vertex data, the accessors below convert to T (double by default, or float)
+    struct Mesh {
+        std::vector<real> verts[3] = {};  // vertices, one array per coordinate       ┐ structure-of-arrays layout for the vertex stage,
+        std::vector<real> norms[3] = {};  // normal vectors, one array per coordinate │ generally speaking, these arrays do not have the same size
+        std::vector<real> tex[2]   = {};  // tex coords, one array per coordinate     ┘ check the logs of the Model() constructor
+        std::vector<int> facet_vrt = {};  //  ┐ per-triangle indices in the above arrays,
+        std::vector<int> facet_nrm = {};  //  │ the size is supposed to be
+        std::vector<int> facet_tex = {};  //  ┘ nfaces()*3
+    };
+    struct MeshView {                     // what the accessors read: the arrays of a Mesh, or the same arrays in the mapped cache file
+        const real *verts[3] = {}, *norms[3] = {}, *tex[2] = {};
+        const int *facet_vrt = nullptr, *facet_nrm = nullptr, *facet_tex = nullptr;
+        int nverts = 0, nnorms = 0, ntex = 0, nfaces = 0;
+    };
+    std::vector<Mesh> lods = {};     // levels of detail: lods[0] is the .obj file, every next one has about half the triangles
+    std::vector<MeshView> views = {}; // one per level of detail, on lods[] or on the cache
+    MappedFile cache = {};           // compiled mesh file the views point to, if any
+    int level = 0;                   // level read by the accessors below
+    static bool load_obj(const MappedFile &file, Mesh &mesh); // v, vn, vt and triangulated f entries only
+    static Mesh compact(const Mesh &mesh, const std::vector<int> &facet_vrt, const std::vector<char> &alive); // live triangles only, the attributes in order of first use
+    void optimize();                 // lods[0]: duplicate attributes merged, then compacted
+    void build_lods();               // quadric error edge collapses, see model.cpp
+    void build_views();
+    static std::uint64_t content_hash(const char *data, const std::size_t size);
+    bool read_cache(const std::string filename, const std::uint64_t hash);  // ┐ compiled mesh file: geometry, bounds and levels of detail,
+    void write_cache(const std::string filename, const std::uint64_t hash); // ┘ tied to the .obj by a hash of its contents
+    Texture diffusemap  = {};        // diffuse color texture
+    Texture normalmap   = {};        // normal map texture
+    Texture specularmap = {};        // specular texture
+    vec3 center = {};                // ┐ bounding sphere
+    double radius = 0;               // ┘ of the vertices
 public:
-    Model(const std::string filename);
-    int nverts() const; // number of vertices
-    int nfaces() const; // number of triangles
-    vec4 vert(const int i) const;                          // 0 <= i < nverts()
-    vec4 vert(const int iface, const int nthvert) const;   // 0 <= iface <= nfaces(), 0 <= nthvert < 3
-    vec4 normal(const int iface, const int nthvert) const; // normal coming from the "vn x y z" entries in the .obj file
-    vec4 normal(const vec2 &uv) const;                     // normal vector from the normal map texture
-    vec2 uv(const int iface, const int nthvert) const;     // uv coordinates of triangle corners
-    const TGAImage& diffuse() const;
-    const TGAImage& specular() const;
+    enum Map { DIFFUSE, NORMAL, SPECULAR };
+    Model(const std::string filename, const bool use_cache=true, const bool textures=true); // use_cache: the .obj is compiled to filename.mesh on first load, later loads map that file
+                                                                                           // textures: false for the geometry alone, the maps can be loaded apart and given to set_map()
+    static Texture load_map(const std::string filename, const Map map); // texture beside the .obj (_diffuse.tga, _nm_tangent.tga or _spec.tga), empty if there is none
+    void set_map(const Map map, Texture tex);
+    int nlods() const;                          // number of levels of detail
+    int lod() const;                            // selected level of detail
+    void select_lod(const int lod);             // all the geometry accessors read this level, 0 <= lod < nlods()
+    int lod_for_area(const double area) const;  // coarsest level keeping about a triangle per pixel of the given screen area
+    int nverts() const;   // number of vertices
+    int nnormals() const; // number of normal vectors
+    int nfaces() const;   // number of triangles
+    template<typename T=double> vec<4,T> vert(const int i) const; // 0 <= i < nverts(), T is the precision of the geometry stage (see our_gl.h)
+    const float* vert_data(const int axis) const;          // ┐ coordinate 0 <= axis < 3 of all the vertices (resp. normals),
+    const float* normal_data(const int axis) const;        // ┘ for batched processing
+    template<typename T=double> vec<4,T> normal(const int i) const; // 0 <= i < nnormals()
+    int vert_index(const int iface, const int nthvert) const;   // ┐ indices of the triangle corners in the above arrays,
+    int normal_index(const int iface, const int nthvert) const; // │ lets a vertex stage process every unique entry once
+    int uv_index(const int iface, const int nthvert) const;     // ┘
+    template<typename T=double> vec<4,T> vert(const int iface, const int nthvert) const;   // 0 <= iface <= nfaces(), 0 <= nthvert < 3
+    template<typename T=double> vec<4,T> normal(const int iface, const int nthvert) const; // normal coming from the "vn x y z" entries in the .obj file
+    template<typename T=double> vec<4,T> normal(const vec<2,T> &uv) const;                 // normal vector from the normal map texture
+    template<typename T=double> vec<2,T> uv(const int iface, const int nthvert) const;     // uv coordinates of triangle corners
+    template<typename T=double> std::pair<vec<3,T>,T> bounding_sphere() const;            // center and radius, for whole-mesh culling
+    const Texture& diffuse() const;
+    const Texture& specular() const;
 
 };
 
@@ -1,31 +1,309 @@
 #include <algorithm>
+#include <cstdint>
+#include <cmath>
 #include "our_gl.h"
 
-mat<4,4> ModelView, Viewport, Perspective; // "OpenGL" state matrices
-std::vector<double> zbuffer;               // depth buffer
+template<typename T> void lookat(BasicRenderContext<T> &ctx, const vec<3,T> eye, const vec<3,T> center, const vec<3,T> up) {
+    vec<3,T> n = normalized(eye-center);
+    vec<3,T> l = normalized(cross(up,n));
+    vec<3,T> m = normalized(cross(n, l));
+    ctx.ModelView = mat<4,4,T>{{{l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1}}} *
+                mat<4,4,T>{{{1,0,0,-center.x}, {0,1,0,-center.y}, {0,0,1,-center.z}, {0,0,0,1}}};
+}
+
+template<typename T> void init_perspective(BasicRenderContext<T> &ctx, const T f) {
+    ctx.Perspective = {{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0, -1/f,1}}};
+}
+
+template<typename T> void init_viewport(BasicRenderContext<T> &ctx, const int x, const int y, const int w, const int h) {
+    ctx.Viewport = {{{T(w/2.), 0, 0, T(x+w/2.)}, {0, T(h/2.), 0, T(y+h/2.)}, {0,0,1,0}, {0,0,0,1}}};
+}
+
+void init_zbuffer(RasterState &ctx, const int width, const int height) {
+    ctx.zbuffer.assign(width*height, -1000.f);
+}
+
+void init_simd(RasterState &ctx, const SimdLevel level) {
+    ctx.simd_level = std::min(level, simd_detect()); // never go above what the CPU supports
+}
+
+// NDC extents of the framebuffer grown by margin pixels on every side: the viewport does not necessarily cover all of it
+template<typename T> static void framebuffer_ndc(const mat<4,4,T> &Viewport, const int width, const int height, float &xmin, float &xmax, float &ymin, float &ymax, const double margin=0) {
+    xmin = (-margin-Viewport[0][3])/Viewport[0][0];
+    xmax = (width +margin-Viewport[0][3])/Viewport[0][0];
+    ymin = (-margin-Viewport[1][3])/Viewport[1][1];
+    ymax = (height+margin-Viewport[1][3])/Viewport[1][1];
+}
+
+// Clipping planes in homogeneous coordinates, a point p is inside of plane i when plane[i]*p >= offset[i]:
+// the near plane, then the four sides of the framebuffer grown by margin pixels.
+template<typename T> static void clip_planes(const mat<4,4,T> &Viewport, const int width, const int height, const double margin, vec<4,T> plane[5], T offset[5]) {
+    float xmin, xmax, ymin, ymax;
+    framebuffer_ndc(Viewport, width, height, xmin, xmax, ymin, ymax, margin);
+    plane[0] = {0, 0, 0, 1};     offset[0] = T(near_w);
+    plane[1] = {1, 0, 0, -xmin}; offset[1] = 0;
+    plane[2] = {-1, 0, 0, xmax}; offset[2] = 0;
+    plane[3] = {0, 1, 0, -ymin}; offset[3] = 0;
+    plane[4] = {0, -1, 0, ymax}; offset[4] = 0;
+}
+
+template<typename T> bool sphere_in_frustum(const BasicRenderContext<T> &ctx, const mat<4,4,T> &m, const vec<3,T> center, const T radius, const int width, const int height) {
+    vec<4,T> plane[5];
+    T offset[5];
+    clip_planes(ctx.Viewport, width, height, 0, plane, offset);
+    for (int i=0; i<5; i++) {
+        const vec<4,T> p = plane[i] * m;               // the plane pulled back to object space
+        const vec<3,T> n = p.xyz();
+        if ((n*center + p.w - offset[i]) < -radius*norm(n)) return false; // the whole sphere is on the outer side
+    }
+    return true;
+}
+
+static void transform_chunk_scalar(const mat4f &m, const float *x, const float *y, const float *z, const float w, const int begin, const int end, const float *bounds, VertexBuffer &out) {
+    for (int i=begin; i<end; i++) {
+        const float4 p = m * float4(x[i], y[i], z[i], w);
+        out.x[i] = p.x; out.y[i] = p.y; out.z[i] = p.z; out.w[i] = p.w;
+        if (!bounds) continue;
+        out.outcode[i] = (p.x<bounds[0]*p.w)*CLIP_LEFT | (p.x>bounds[1]*p.w)*CLIP_RIGHT | (p.y<bounds[2]*p.w)*CLIP_BOTTOM | (p.y>bounds[3]*p.w)*CLIP_TOP | (p.w<=0)*CLIP_NEAR;
+    }
+}
+
+#if defined(SIMD_X86)
+static void transform_chunk_sse2(const mat4f &m, const float *x, const float *y, const float *z, const float w, const int begin, const int end, const float *bounds, VertexBuffer &out) {
+    __m128 c[4][4];                                                  // matrix entries broadcast to all the lanes
+    for (int r=0; r<4; r++)
+        for (int k=0; k<4; k++)
+            c[r][k] = _mm_set1_ps(k<3 ? m(r,k) : m(r,k)*w);
+    float *dst[4] = { out.x.data(), out.y.data(), out.z.data(), out.w.data() };
+    int i = begin;
+    for (; i+4<=end; i+=4) {
+        const __m128 px = _mm_loadu_ps(x+i), py = _mm_loadu_ps(y+i), pz = _mm_loadu_ps(z+i);
+        __m128 p[4];
+        for (int r=0; r<4; r++) {
+            p[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r][0], px), _mm_mul_ps(c[r][1], py)), _mm_mul_ps(c[r][2], pz)), c[r][3]); // same order as mat4f*float4
+            _mm_storeu_ps(dst[r]+i, p[r]);
+        }
+        if (!bounds) continue;
+        const int masks[5] = {
+            _mm_movemask_ps(_mm_cmplt_ps(p[0], _mm_mul_ps(_mm_set1_ps(bounds[0]), p[3]))),
+            _mm_movemask_ps(_mm_cmpgt_ps(p[0], _mm_mul_ps(_mm_set1_ps(bounds[1]), p[3]))),
+            _mm_movemask_ps(_mm_cmplt_ps(p[1], _mm_mul_ps(_mm_set1_ps(bounds[2]), p[3]))),
+            _mm_movemask_ps(_mm_cmpgt_ps(p[1], _mm_mul_ps(_mm_set1_ps(bounds[3]), p[3]))),
+            _mm_movemask_ps(_mm_cmple_ps(p[3], _mm_setzero_ps()))
+        };
+        for (int lane=0; lane<4; lane++) {
+            std::uint8_t code = 0;
+            for (int b=0; b<5; b++) code |= (masks[b]>>lane & 1) << b;
+            out.outcode[i+lane] = code;
+        }
+    }
+    transform_chunk_scalar(m, x, y, z, w, i, end, bounds, out);
+}
+
+SIMD_TARGET_AVX2 static void transform_chunk_avx2(const mat4f &m, const float *x, const float *y, const float *z, const float w, const int begin, const int end, const float *bounds, VertexBuffer &out) {
+    __m256 c[4][4];                                                  // matrix entries broadcast to all the lanes
+    for (int r=0; r<4; r++)
+        for (int k=0; k<4; k++)
+            c[r][k] = _mm256_set1_ps(k<3 ? m(r,k) : m(r,k)*w);
+    float *dst[4] = { out.x.data(), out.y.data(), out.z.data(), out.w.data() };
+    int i = begin;
+    for (; i+8<=end; i+=8) {
+        const __m256 px = _mm256_loadu_ps(x+i), py = _mm256_loadu_ps(y+i), pz = _mm256_loadu_ps(z+i);
+        __m256 p[4];
+        for (int r=0; r<4; r++) {
+            p[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[r][0], px), _mm256_mul_ps(c[r][1], py)), _mm256_mul_ps(c[r][2], pz)), c[r][3]);
+            _mm256_storeu_ps(dst[r]+i, p[r]);
+        }
+        if (!bounds) continue;
+        const int masks[5] = {
+            _mm256_movemask_ps(_mm256_cmp_ps(p[0], _mm256_mul_ps(_mm256_set1_ps(bounds[0]), p[3]), _CMP_LT_OQ)),
+            _mm256_movemask_ps(_mm256_cmp_ps(p[0], _mm256_mul_ps(_mm256_set1_ps(bounds[1]), p[3]), _CMP_GT_OQ)),
+            _mm256_movemask_ps(_mm256_cmp_ps(p[1], _mm256_mul_ps(_mm256_set1_ps(bounds[2]), p[3]), _CMP_LT_OQ)),
+            _mm256_movemask_ps(_mm256_cmp_ps(p[1], _mm256_mul_ps(_mm256_set1_ps(bounds[3]), p[3]), _CMP_GT_OQ)),
+            _mm256_movemask_ps(_mm256_cmp_ps(p[3], _mm256_setzero_ps(), _CMP_LE_OQ))
+        };
+        for (int lane=0; lane<8; lane++) {
+            std::uint8_t code = 0;
+            for (int b=0; b<5; b++) code |= (masks[b]>>lane & 1) << b;
+            out.outcode[i+lane] = code;
+        }
+    }
+    transform_chunk_scalar(m, x, y, z, w, i, end, bounds, out);
+}
+#endif
+
+template<typename T> void transform_vertices(const BasicRenderContext<T> &ctx, const mat4f &m, const float *x, const float *y, const float *z, const float w, const int n,
+                        const int width, const int height, VertexBuffer &out, ThreadPool &pool) {
+    constexpr int chunk = 1024;                                      // vertices per job
+    for (std::vector<float> *v : {&out.x, &out.y, &out.z, &out.w}) v->resize(n);
+    out.outcode.resize(w ? n : 0);
+    float bounds[4];
+    framebuffer_ndc(ctx.Viewport, width, height, bounds[0], bounds[1], bounds[2], bounds[3]);
+    const float *b = w ? bounds : nullptr;
+    pool.parallel_for((n + chunk - 1) / chunk, [&](const int job) {
+        const int begin = job*chunk, end = std::min(n, begin + chunk);
+#if defined(SIMD_X86)
+        if (ctx.simd_level==SimdLevel::AVX2) return transform_chunk_avx2(m, x, y, z, w, begin, end, b, out);
+        if (ctx.simd_level==SimdLevel::SSE2) return transform_chunk_sse2(m, x, y, z, w, begin, end, b, out);
+#endif
+        transform_chunk_scalar(m, x, y, z, w, begin, end, b, out);
+    });
+}
+
+template<typename T> static bool setup_triangle(const mat<4,4,T> &Viewport, const BasicTriangle<T> &clip, const int width, const int height, const std::int64_t min_area, TriangleSetup &t) {
+    constexpr int subpixel_bits = 8;              // 24.8 fixed point screen coordinates
+    constexpr std::int64_t one = 1<<subpixel_bits;
+    vec<4,T> ndc[3]    = { clip[0]/clip[0].w, clip[1]/clip[1].w, clip[2]/clip[2].w };                // normalized device coordinates
+    vec<2,T> screen[3] = { (Viewport*ndc[0]).xy(), (Viewport*ndc[1]).xy(), (Viewport*ndc[2]).xy() }; // screen coordinates
+
+    std::int64_t X[3], Y[3];                      // snapped vertex positions
+    for (int i : {0,1,2}) {
+        X[i] = std::llround(screen[i].x*one);
+        Y[i] = std::llround(screen[i].y*one);
+    }
+    const std::int64_t area = (X[1]-X[0])*(Y[2]-Y[0]) - (X[2]-X[0])*(Y[1]-Y[0]); // twice the signed area, same as ABC.det()
+    if (area<=0 || area<min_area*one*one) return false; // backface culling + discarding triangles that cover less than a pixel, never a null one (1/area below)
 
-void lookat(const vec3 eye, const vec3 center, const vec3 up) {
-    vec3 n = normalized(eye-center);
-    vec3 l = normalized(cross(up,n));
-    vec3 m = normalized(cross(n, l));
-    ModelView = mat<4,4>{{{l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1}}} *
-                mat<4,4>{{{1,0,0,-center.x}, {0,1,0,-center.y}, {0,0,1,-center.z}, {0,0,0,1}}};
+    t.xmin = std::max<std::int64_t>(std::min({X[0], X[1], X[2]}) >> subpixel_bits, 0); // bounding box for the triangle
+    t.ymin = std::max<std::int64_t>(std::min({Y[0], Y[1], Y[2]}) >> subpixel_bits, 0); // clipped by the screen
+    t.xmax = std::min<std::int64_t>(std::max({X[0], X[1], X[2]}) >> subpixel_bits, width-1);
+    t.ymax = std::min<std::int64_t>(std::max({Y[0], Y[1], Y[2]}) >> subpixel_bits, height-1);
+    if (t.xmin>t.xmax || t.ymin>t.ymax) return false;
+
+    // edge function i is opposite to vertex i, E_i(x,y) = A_i*x + B_i*y + C_i, and E_i/area is the screen barycentric coordinate
+    for (int i : {0,1,2}) {
+        const int j = (i+1)%3, k = (i+2)%3;
+        t.A[i] = (Y[j]-Y[k])*one;                 // increment per pixel step along x
+        t.B[i] = (X[k]-X[j])*one;                 // increment per pixel step along y
+        t.E[i] = (X[j]-t.xmin*one)*(Y[k]-t.ymin*one) - (X[k]-t.xmin*one)*(Y[j]-t.ymin*one); // value at the top left corner of the box
+    }
+    const double inv_area = 1./area;
+    const vec3 z = { ndc[0].z, ndc[1].z, ndc[2].z }; // the depth plane is in double whatever T is
+    t.dzdx = (t.A[0]*z.x + t.A[1]*z.y + t.A[2]*z.z)*inv_area; // depth plane equation
+    t.dzdy = (t.B[0]*z.x + t.B[1]*z.y + t.B[2]*z.z)*inv_area;
+    t.z0   = (t.E[0]*z.x + t.E[1]*z.y + t.E[2]*z.z)*inv_area;
+    t.zmax = std::max({z.x, z.y, z.z}) + 1e-9; // the depth plane is linear, small margin for the rounding of its incremental evaluation
+    t.iw   = { 1./clip[0].w, 1./clip[1].w, 1./clip[2].w };
+    t.id   = -1;
+    t.clipped = false;
+    return true;
 }
 
-void init_perspective(const double f) {
-    Perspective = {{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0, -1/f,1}}};
+template<typename T> T sphere_screen_area(const BasicRenderContext<T> &ctx, const mat<4,4,T> &m, const vec<3,T> center, const T radius) {
+    const T w = m[3]*vec<4,T>{center.x, center.y, center.z, 1};
+    if (w - radius*norm(m[3].xyz()) <= near_w) return HUGE_VAL;
+    const T rx = radius*norm(m[0].xyz())/w*ctx.Viewport[0][0];  // the ellipse radii in pixels, ignoring the variation of w across the sphere
+    const T ry = radius*norm(m[1].xyz())/w*ctx.Viewport[1][1];
+    return T(3.14159265358979)*rx*ry;
 }
 
-void init_viewport(const int x, const int y, const int w, const int h) {
-    Viewport = {{{w/2., 0, 0, x+w/2.}, {0, h/2., 0, y+h/2.}, {0,0,1,0}, {0,0,0,1}}};
+// Clipping stage: triangles crossing the near plane are cut in homogeneous coordinates (before the division by w),
+// the ones reaching beyond the guard band are cut by its sides, everything else only has its bounding box clipped by the screen.
+// The pieces remember the barycentric coordinates of their corners w.r.t. the input triangle, so the shaders see no difference.
+// Returns the number of entries written to t[].
+template<typename T> int clip_triangle(const BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const int width, const int height, TriangleSetup t[clip_max_triangles]) {
+    vec<4,T> plane[5];
+    T offset[5];
+    clip_planes(ctx.Viewport, width, height, guard_band, plane, offset);
+    int outcode[3] = {0, 0, 0};
+    for (int i : {0,1,2})
+        for (int j=0; j<5; j++)
+            outcode[i] |= (plane[j]*clip[i] < offset[j]) << j;
+    if (outcode[0] & outcode[1] & outcode[2]) return 0;               // entirely on the outer side of one of the planes
+    if (!(outcode[0] | outcode[1] | outcode[2]))                      // common case: nothing to cut
+        return setup_triangle(ctx.Viewport, clip, width, height, 1, t[0]);
+
+    struct Corner { vec<4,T> p; vec<3,T> bar; };
+    Corner poly[8] = { {clip[0], {1,0,0}}, {clip[1], {0,1,0}}, {clip[2], {0,0,1}} }, tmp[8];
+    int n = 3;
+    for (int j=0; j<5 && n; j++) {                                    // Sutherland-Hodgman, one plane at a time
+        if (!((outcode[0] | outcode[1] | outcode[2]) >> j & 1)) continue;
+        int m = 0;
+        for (int i=0; i<n; i++) {
+            const Corner &a = poly[i], &b = poly[(i+1)%n];
+            const T da = plane[j]*a.p - offset[j], db = plane[j]*b.p - offset[j];
+            if (da>=0) tmp[m++] = a;
+            if ((da>=0) != (db>=0)) {                                 // the edge crosses the plane
+                const T s = da/(da-db);
+                tmp[m++] = { a.p + (b.p-a.p)*s, a.bar + (b.bar-a.bar)*s };
+            }
+        }
+        std::copy(tmp, tmp+m, poly);
+        n = m;
+    }
+
+    int cnt = 0;
+    for (int i=1; i+1<n; i++) {                                       // triangle fan, the winding is preserved
+        const BasicTriangle<T> piece = { poly[0].p, poly[i].p, poly[i+1].p };
+        if (!setup_triangle(ctx.Viewport, piece, width, height, 0, t[cnt])) continue; // no minimal area: a sliver of a large triangle still covers pixels
+        t[cnt].bar = mat<3,3>{{vec_cast<double>(poly[0].bar), vec_cast<double>(poly[i].bar), vec_cast<double>(poly[i+1].bar)}}.transpose();
+        t[cnt].clipped = true;
+        cnt++;
+    }
+    return cnt;
 }
 
-void init_zbuffer(const int width, const int height) {
-    zbuffer = std::vector(width*height, -1000.);
+template<typename T> void rasterize(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const IShader &shader, TGAImage &framebuffer) {
+    rasterize<IShader, T>(ctx, clip, shader, framebuffer);
+}
+
+template<typename T> void BasicBinnedRasterizer<T>::begin(BasicRenderContext<T> &context, const int w, const int h) {
+    ctx     = &context;
+    width   = w;
+    height  = h;
+    tiles_x = (w + tile_size - 1) / tile_size;
+    tiles_y = (h + tile_size - 1) / tile_size;
+    cells_x = tiles_x * tile_size / hiz_size;
+    triangles.clear();
+    bins.resize(tiles_x*tiles_y);
+    hiz.resize(cells_x * tiles_y * tile_size / hiz_size);
+    hiz_dirty.resize(hiz.size());
+}
+
+template<typename T> void BasicBinnedRasterizer<T>::submit(const BasicTriangle<T> &clip, const int id) {
+    TriangleSetup t[clip_max_triangles];
+    const int n = clip_triangle(*ctx, clip, width, height, t);
+    for (int i=0; i<n; i++) {
+        t[i].id = id;
+        triangles.push_back(t[i]);
+    }
+}
+
+template<typename T> void BasicBinnedRasterizer<T>::set_occlusion_culling(const bool enabled) {
+    occlusion_culling = enabled;
+}
+
+template<typename T> void BasicBinnedRasterizer<T>::bin() {
+    order.resize(triangles.size());
+    for (int i=0; i<(int)order.size(); i++) order[i] = i;
+    if (occlusion_culling) // front to back: the closest triangles fill the hierarchical z first
+        std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) { return triangles[a].zmax > triangles[b].zmax; });
+    for (std::vector<int> &bin : bins) bin.clear(); // keep the capacity from one frame to the next
+    for (const int index : order) {
+        const TriangleSetup &t = triangles[index];
+        for (int ty=t.ymin/tile_size; ty<=t.ymax/tile_size; ty++)
+            for (int tx=t.xmin/tile_size; tx<=t.xmax/tile_size; tx++)
+                bins[tx+ty*tiles_x].push_back(index); // drawing order is preserved inside every bin
+    }
+}
+
+template<typename T> double BasicBinnedRasterizer<T>::cell_depth(const int cx, const int cy) {
+    const int cell = cx + cy*cells_x;
+    if (hiz_dirty[cell]) {
+        double zmin = HUGE_VAL;
+        for (int y=cy*hiz_size; y<std::min((cy+1)*hiz_size, height); y++)
+            for (int x=cx*hiz_size; x<std::min((cx+1)*hiz_size, width); x++)
+                zmin = std::min<double>(zmin, ctx->zbuffer[x+y*width]);
+        hiz[cell] = zmin;
+        hiz_dirty[cell] = 0;
+    }
+    return hiz[cell];
 }
 
-void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer) {
-    vec4 ndc[3]    = { clip[0]/clip[0].w, clip[1]/clip[1].w, clip[2]/clip[2].w };                // normalized device coordinates
+template<typename T> void rasterize_reference(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const IShader &shader, TGAImage &framebuffer) {
+    const mat<4,4> Viewport = mat_cast<double>(ctx.Viewport); // the reference stays in double
+    std::vector<float> &zbuffer = ctx.zbuffer;
+    vec4 ndc[3]    = { vec_cast<double>(clip[0]/clip[0].w), vec_cast<double>(clip[1]/clip[1].w), vec_cast<double>(clip[2]/clip[2].w) }; // normalized device coordinates
     vec2 screen[3] = { (Viewport*ndc[0]).xy(), (Viewport*ndc[1]).xy(), (Viewport*ndc[2]).xy() }; // screen coordinates
 
     mat<3,3> ABC = {{ {screen[0].x, screen[0].y, 1.}, {screen[1].x, screen[1].y, 1.}, {screen[2].x, screen[2].y, 1.} }};
@@ -50,3 +328,17 @@ void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffe
     }
 }
 
+// The two precisions of the geometry stage
+#define OUR_GL_INSTANTIATE(T) \
+    template void lookat(BasicRenderContext<T>&, const vec<3,T>, const vec<3,T>, const vec<3,T>); \
+    template void init_perspective(BasicRenderContext<T>&, const T); \
+    template void init_viewport(BasicRenderContext<T>&, const int, const int, const int, const int); \
+    template void transform_vertices(const BasicRenderContext<T>&, const mat4f&, const float*, const float*, const float*, const float, const int, const int, const int, VertexBuffer&, ThreadPool&); \
+    template bool sphere_in_frustum(const BasicRenderContext<T>&, const mat<4,4,T>&, const vec<3,T>, const T, const int, const int); \
+    template T sphere_screen_area(const BasicRenderContext<T>&, const mat<4,4,T>&, const vec<3,T>, const T); \
+    template int clip_triangle(const BasicRenderContext<T>&, const BasicTriangle<T>&, const int, const int, TriangleSetup[clip_max_triangles]); \
+    template void rasterize(BasicRenderContext<T>&, const BasicTriangle<T>&, const IShader&, TGAImage&); \
+    template void rasterize_reference(BasicRenderContext<T>&, const BasicTriangle<T>&, const IShader&, TGAImage&); \
+    template class BasicBinnedRasterizer<T>;
+OUR_GL_INSTANTIATE(double)
+OUR_GL_INSTANTIATE(float)
@@ -1,18 +1,117 @@
+#pragma once
+#include <cstdint>
 #include "tgaimage.h"
 #include "geometry.h"
+#include "threadpool.h"
+#include "simd.h"
+#include "fmath.h"
 
-void lookat(const vec3 eye, const vec3 center, const vec3 up);
-void init_perspective(const double f);
-void init_viewport(const int x, const int y, const int w, const int h);
-void init_zbuffer(const int width, const int height);
+// The geometry stage (matrices, culling, clipping) is templated on its scalar type T, double or float: the functions below are
+// instantiated for both in our_gl.cpp. The raster stage works on fixed point edge functions and a double depth plane whatever T is.
+struct RasterState {                               // what the raster stage reads and writes
+    std::vector<float> zbuffer = {};               // depth buffer, single precision
+    SimdLevel simd_level = simd_detect();          // set by init_simd()
+};
+
+template<typename T> struct BasicRenderContext : RasterState { // "OpenGL" state, passed explicitly to every stage: nothing is shared between two contexts,
+    mat<4,4,T> ModelView, Viewport, Perspective;                // so separate renderers (viewports, offscreen targets) can run on separate threads
+};
+typedef BasicRenderContext<double> RenderContext;
+typedef BasicRenderContext<float>  RenderContextf;
+
+template<typename T> void lookat(BasicRenderContext<T> &ctx, const vec<3,T> eye, const vec<3,T> center, const vec<3,T> up);
+template<typename T> void init_perspective(BasicRenderContext<T> &ctx, const T f);
+template<typename T> void init_viewport(BasicRenderContext<T> &ctx, const int x, const int y, const int w, const int h);
+void init_zbuffer(RasterState &ctx, const int width, const int height); // clears the z-buffer, reallocates only when the size grows
+void init_simd(RasterState &ctx, const SimdLevel level); // pixel pipeline of the edge-function rasterizers, clamped to what the CPU supports
+
+enum Outcode : std::uint8_t { CLIP_LEFT=1, CLIP_RIGHT=2, CLIP_BOTTOM=4, CLIP_TOP=8, CLIP_NEAR=16 }; // w<=0 counts as near
+
+struct VertexBuffer {                    // post-transform vertex data, structure-of-arrays layout
+    std::vector<float> x, y, z, w;       // clip coordinates
+    std::vector<std::uint8_t> outcode;   // Outcode bits w.r.t. the framebuffer, for trivial rejection
+    int size() const { return x.size(); }
+    vec4 operator[](const int i) const { return {x[i], y[i], z[i], w[i]}; }
+};
+
+// Vertex stage: out[i] = m*{x[i], y[i], z[i], w}, in SIMD chunks spread over the pool.
+// For w=1 (points) the outcodes are computed against the framebuffer of the given size seen through ctx.Viewport,
+// w=0 (directions) leaves them empty.
+template<typename T> void transform_vertices(const BasicRenderContext<T> &ctx, const mat4f &m, const float *x, const float *y, const float *z, const float w, const int n,
+                        const int width, const int height, VertexBuffer &out, ThreadPool &pool);
 
 struct IShader {
     static TGAColor sample2D(const TGAImage &img, const vec2 &uvf) {
         return img.get(uvf[0] * img.width(), uvf[1] * img.height());
     }
     virtual std::pair<bool,TGAColor> fragment(const vec3 bar) const = 0;
+    virtual std::pair<bool,TGAColor> fragment(const int /*id*/, const vec3 bar) const { return fragment(bar); } // binned rasterization, id as given to BinnedRasterizer::submit()
+    virtual int fragment_batch(const int id, const int n, const vec3 bar[], const int mask, TGAColor color[]) const { // SIMD pixel pipeline: shades the fragments i<n
+        int keep = 0;                                                                                                // whose bit is set in mask, returns the ones not discarded
+        for (int i=0; i<n; i++) {
+            if (!(mask>>i & 1)) continue;
+            auto [discard, c] = id<0 ? fragment(bar[i]) : fragment(id, bar[i]);
+            if (discard) continue;
+            color[i] = c;
+            keep |= 1<<i;
+        }
+        return keep;
+    }
 };
 
-typedef vec4 Triangle[3]; // a triangle primitive is made of three ordered points
-void rasterize(const Triangle &clip, const IShader &shader, TGAImage &framebuffer);
+template<typename T> using BasicTriangle = vec<4,T>[3]; // a triangle primitive is made of three ordered points
+typedef BasicTriangle<double> Triangle;
+constexpr double near_w     = 1e-2;  // near clipping plane w = near_w, in units of the eye-center distance given to init_perspective()
+constexpr double guard_band = 4096;  // pixels around the framebuffer where triangles are rasterized without being cut, keeps the fixed point edge functions small
+constexpr int clip_max_triangles = 6; // a triangle cut by the near plane and the four sides of the guard band
+template<typename T> bool sphere_in_frustum(const BasicRenderContext<T> &ctx, const mat<4,4,T> &m, const vec<3,T> center, const T radius, const int width, const int height); // m maps to clip space, false if the sphere is entirely off the framebuffer or behind the near plane
+template<typename T> T sphere_screen_area(const BasicRenderContext<T> &ctx, const mat<4,4,T> &m, const vec<3,T> center, const T radius); // approximate area covered by the sphere on the screen in pixels, infinite when the camera is inside
+template<class Shader, typename T> void rasterize(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const Shader &shader, TGAImage &framebuffer); // clipping, then incremental fixed-point edge functions, setup once per triangle;
+template<typename T> void rasterize(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const IShader &shader, TGAImage &framebuffer); // specialized on the concrete shader type (raster.h), this one is the virtual fallback
+template<typename T> void rasterize_reference(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const IShader &shader, TGAImage &framebuffer); // per-pixel barycentric inversion, kept for A/B comparison
+
+
+struct TriangleSetup {             // per-triangle constants of the edge-function rasterizer
+    int xmin, ymin, xmax, ymax;    // bounding box, clipped by the framebuffer
+    std::int64_t A[3], B[3], E[3]; // edge functions: increments along x and y, values at (xmin,ymin)
+    double z0, dzdx, dzdy;         // depth plane equation
+    double zmax;                   // closest depth of the triangle, for occlusion culling
+    vec3 iw;                       // 1/w of the vertices, for perspective-correct interpolation
+    int id;                        // forwarded to IShader::fragment(), -1 for the immediate rasterize()
+    bool clipped;                  // piece of a triangle cut by the clipping stage,
+    mat<3,3> bar;                  // its corners in barycentric coordinates of the original triangle (columns)
+};
+
+template<typename T> int clip_triangle(const BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const int width, const int height, TriangleSetup t[clip_max_triangles]); // near plane + guard band clipping and setup, returns the number of pieces in t[]
+
+struct VisibilityBuffer {           // what is visible in every pixel, for deferred shading
+    std::vector<int>  id = {};     // triangle id, -1 if nothing was drawn
+    std::vector<vec3> bar = {};    // perspective-correct barycentric coordinates in that triangle
+};
+
+template<typename T> class BasicBinnedRasterizer { // sorts triangles into screen tiles, then every worker owns whole tiles of the framebuffer and the z-buffer
+public:
+    static constexpr int tile_size = 16;
+    static constexpr int hiz_size  = 4;               // side of a hierarchical z cell in pixels, divides tile_size
+    void begin(BasicRenderContext<T> &ctx, const int width, const int height); // new frame, empties the bins; ctx is used until the next begin()
+    void submit(const BasicTriangle<T> &clip, const int id); // triangle setup, the binning is done by flush
+    template<class Shader> void flush(const Shader &shader, TGAImage &framebuffer, ThreadPool &pool);
+    template<class Shader> void flush_visibility(const Shader &shader, TGAImage &framebuffer, ThreadPool &pool); // visibility buffer first, then one fragment() per visible pixel
+    void set_occlusion_culling(const bool enabled);  // hierarchical z rejection + front-to-back order, on by default
+private:
+    void bin();
+    template<class Shader> void rasterize_tile(const int tile, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis);
+    double cell_depth(const int cx, const int cy);
+    BasicRenderContext<T> *ctx = nullptr;
+    int width = 0, height = 0, tiles_x = 0, tiles_y = 0, cells_x = 0;
+    bool occlusion_culling = true;
+    std::vector<TriangleSetup> triangles = {};
+    std::vector<int> order = {};                     // drawing order of the triangles
+    std::vector<std::vector<int>> bins = {};         // indices in triangles[], per tile
+    std::vector<double> hiz = {};                    // per cell: farthest depth stored in the z-buffer,
+    std::vector<std::uint8_t> hiz_dirty = {};        // recomputed lazily after the cell was drawn to
+    VisibilityBuffer visibility = {};
+};
+typedef BasicBinnedRasterizer<double> BinnedRasterizer;
 
+#include "raster.h"
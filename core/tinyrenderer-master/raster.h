@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "our_gl.h"
+
+// Pixel pipeline of the edge-function rasterizers, templated on the shader type. Instantiated with a concrete (final) shader,
+// the fragment calls are resolved at compile time and inlined into the raster loops; with IShader they go through the vtable.
+
+template<class Shader> void rasterize_box_scalar(RasterState &ctx, const TriangleSetup &t, const int x0, const int y0, const int x1, const int y1, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+    const int width = framebuffer.width();
+    std::vector<float> &zbuffer = ctx.zbuffer;
+    for (int y=y0; y<=y1; y++) {
+        std::int64_t e0 = t.E[0] + t.A[0]*(x0-t.xmin) + t.B[0]*(y-t.ymin);
+        std::int64_t e1 = t.E[1] + t.A[1]*(x0-t.xmin) + t.B[1]*(y-t.ymin);
+        std::int64_t e2 = t.E[2] + t.A[2]*(x0-t.xmin) + t.B[2]*(y-t.ymin);
+        double depth = t.z0 + t.dzdx*(x0-t.xmin) + t.dzdy*(y-t.ymin);
+        for (int x=x0; x<=x1; x++, e0+=t.A[0], e1+=t.A[1], e2+=t.A[2], depth+=t.dzdx) {
+            if ((e0|e1|e2)<0) continue;                                  // negative edge function => the pixel is outside the triangle
+            if (depth <= zbuffer[x+y*width]) continue;                   // discard fragments that are too deep w.r.t the z-buffer
+            vec3 bc_clip = { e0*t.iw.x, e1*t.iw.y, e2*t.iw.z };          // perspective-correct barycentric coordinates
+            bc_clip = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z);
+            if (t.clipped) bc_clip = t.bar * bc_clip;                    // piece of a clipped triangle: back to the barycentric coordinates of the whole
+            if (vis) {                                                   // visibility pass: remember what is visible, shade later
+                zbuffer[x+y*width]  = depth;
+                vis->id[x+y*width]  = t.id;
+                vis->bar[x+y*width] = bc_clip;
+                continue;
+            }
+            auto [discard, color] = t.id<0 ? shader.fragment(bc_clip) : shader.fragment(t.id, bc_clip);
+            if (discard) continue;                                       // fragment shader can discard current fragment
+            zbuffer[x+y*width] = depth;                                  // update the z-buffer
+            framebuffer.set(x, y, color);                                // update the framebuffer
+        }
+    }
+}
+
+// The SIMD kernels walk the box by blocks of n x 2 pixels (n = 2 for SSE2, 4 for AVX2), lane i<n is (x+i,y), lane i>=n is (x+i-n,y+1).
+// Edge functions are evaluated in double precision: they are integers well below 2^53, so the coverage is exactly the one of the scalar path.
+inline int box_mask(const int x, const int y, const int n, const int x0, const int y0, const int x1, const int y1) {
+    int mask = 0;
+    for (int i=0; i<n; i++) {
+        const bool inx = x+i>=x0 && x+i<=x1;
+        mask |= (inx && y>=y0 && y<=y1) << i;
+        mask |= (inx && y+1>=y0 && y+1<=y1) << (i+n);
+    }
+    return mask;
+}
+
+inline void load_depth(const std::vector<float> &zbuffer, const int x, const int y, const int n, const int valid, const int width, double *zb) { // +inf in the lanes outside of the box
+    for (int i=0; i<2*n; i++)
+        zb[i] = (valid>>i & 1) ? zbuffer[x+i%n + (y+i/n)*width] : HUGE_VAL;
+}
+
+template<class Shader> void shade_lanes(RasterState &ctx, const TriangleSetup &t, const int x, const int y, const int n, int mask, const double *depth, const double *b0, const double *b1, const double *b2, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+    const int width = framebuffer.width();
+    std::vector<float> &zbuffer = ctx.zbuffer;
+    vec3 bar[8];
+    TGAColor color[8];
+    for (int i=0; i<2*n; i++)
+        bar[i] = t.clipped ? t.bar * vec3{b0[i], b1[i], b2[i]} : vec3{b0[i], b1[i], b2[i]};
+    if (vis) {                                                           // visibility pass: remember what is visible, shade later
+        for (int i=0; i<2*n; i++) {
+            if (!(mask>>i & 1)) continue;
+            const int p = x+i%n + (y+i/n)*width;
+            zbuffer[p]  = depth[i];
+            vis->id[p]  = t.id;
+            vis->bar[p] = bar[i];
+        }
+        return;
+    }
+    mask = shader.fragment_batch(t.id, 2*n, bar, mask, color);
+    for (int i=0; i<2*n; i++) {
+        if (!(mask>>i & 1)) continue;
+        const int px = x+i%n, py = y+i/n;
+        zbuffer[px+py*width] = depth[i];                                 // masked z-buffer write
+        framebuffer.set(px, py, color[i]);
+    }
+}
+
+#if defined(SIMD_X86)
+template<class Shader> void rasterize_box_sse2(RasterState &ctx, const TriangleSetup &t, const int x0, const int y0, const int x1, const int y1, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+    const int width = framebuffer.width();
+    std::vector<float> &zbuffer = ctx.zbuffer;
+    const __m128d zero = _mm_setzero_pd();
+    __m128d step[3], iw[3];
+    for (int i : {0,1,2}) {
+        step[i] = _mm_set1_pd(2.*t.A[i]);
+        iw[i]   = _mm_set1_pd(t.iw[i]);
+    }
+    const __m128d zstep = _mm_set1_pd(2.*t.dzdx);
+    alignas(16) double depth[4], zb[4], b[3][4];
+    for (int y=y0&~1; y<=y1; y+=2) {
+        const int xs = x0&~1;
+        __m128d e[3][2], z[2];                                           // rows y and y+1
+        for (int i : {0,1,2}) {
+            const double e00 = t.E[i] + t.A[i]*(xs-t.xmin) + t.B[i]*(y-t.ymin);
+            e[i][0] = _mm_setr_pd(e00,           e00 + t.A[i]);
+            e[i][1] = _mm_setr_pd(e00 + t.B[i],  e00 + t.A[i] + t.B[i]);
+        }
+        const double z00 = t.z0 + t.dzdx*(xs-t.xmin) + t.dzdy*(y-t.ymin);
+        z[0] = _mm_setr_pd(z00,          z00 + t.dzdx);
+        z[1] = _mm_setr_pd(z00 + t.dzdy, z00 + t.dzdx + t.dzdy);
+        for (int x=xs; x<=x1; x+=2) {
+            const int valid = box_mask(x, y, 2, x0, y0, x1, y1);
+            int inside = 0;
+            for (int r : {0,1})
+                inside |= _mm_movemask_pd(_mm_and_pd(_mm_and_pd(_mm_cmpge_pd(e[0][r], zero), _mm_cmpge_pd(e[1][r], zero)), _mm_cmpge_pd(e[2][r], zero))) << 2*r;
+            int mask = valid & inside;                                   // coverage mask
+            if (mask) {
+                if (15==valid) {
+                    _mm_store_pd(zb,   _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&zbuffer[x + y*width])))));     // two floats
+                    _mm_store_pd(zb+2, _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&zbuffer[x + (y+1)*width]))))); // widened to doubles
+                } else load_depth(zbuffer, x, y, 2, valid, width, zb);
+                int closer = 0;
+                for (int r : {0,1})
+                    closer |= _mm_movemask_pd(_mm_cmpgt_pd(z[r], _mm_load_pd(zb+2*r))) << 2*r;
+                mask &= closer;                                          // depth test mask
+            }
+            if (mask) {
+                for (int r : {0,1}) {
+                    __m128d bc[3];
+                    for (int i : {0,1,2}) bc[i] = _mm_mul_pd(e[i][r], iw[i]); // perspective-correct barycentric coordinates
+                    const __m128d sum = _mm_add_pd(_mm_add_pd(bc[0], bc[1]), bc[2]);
+                    for (int i : {0,1,2}) _mm_store_pd(b[i]+2*r, _mm_div_pd(bc[i], sum));
+                    _mm_store_pd(depth+2*r, z[r]);
+                }
+                shade_lanes(ctx, t, x, y, 2, mask, depth, b[0], b[1], b[2], shader, framebuffer, vis);
+            }
+            for (int i : {0,1,2})
+                for (int r : {0,1})
+                    e[i][r] = _mm_add_pd(e[i][r], step[i]);
+            for (int r : {0,1})
+                z[r] = _mm_add_pd(z[r], zstep);
+        }
+    }
+}
+
+template<class Shader> SIMD_TARGET_AVX2 void rasterize_box_avx2(RasterState &ctx, const TriangleSetup &t, const int x0, const int y0, const int x1, const int y1, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+    const int width = framebuffer.width();
+    std::vector<float> &zbuffer = ctx.zbuffer;
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d step[3], iw[3];
+    for (int i : {0,1,2}) {
+        step[i] = _mm256_set1_pd(4.*t.A[i]);
+        iw[i]   = _mm256_set1_pd(t.iw[i]);
+    }
+    const __m256d zstep = _mm256_set1_pd(4.*t.dzdx);
+    alignas(32) double depth[8], zb[8], b[3][8];
+    for (int y=y0&~1; y<=y1; y+=2) {
+        const int xs = x0&~3;
+        __m256d e[3][2], z[2];                                           // rows y and y+1
+        for (int i : {0,1,2}) {
+            const double e00 = t.E[i] + t.A[i]*(xs-t.xmin) + t.B[i]*(y-t.ymin);
+            e[i][0] = _mm256_setr_pd(e00,          e00 + t.A[i],          e00 + 2.*t.A[i],          e00 + 3.*t.A[i]);
+            e[i][1] = _mm256_setr_pd(e00 + t.B[i], e00 + t.A[i] + t.B[i], e00 + 2.*t.A[i] + t.B[i], e00 + 3.*t.A[i] + t.B[i]);
+        }
+        const double z00 = t.z0 + t.dzdx*(xs-t.xmin) + t.dzdy*(y-t.ymin);
+        z[0] = _mm256_setr_pd(z00,          z00 + t.dzdx,          z00 + 2*t.dzdx,          z00 + 3*t.dzdx);
+        z[1] = _mm256_setr_pd(z00 + t.dzdy, z00 + t.dzdx + t.dzdy, z00 + 2*t.dzdx + t.dzdy, z00 + 3*t.dzdx + t.dzdy);
+        for (int x=xs; x<=x1; x+=4) {
+            const int valid = box_mask(x, y, 4, x0, y0, x1, y1);
+            int inside = 0;
+            for (int r : {0,1})
+                inside |= _mm256_movemask_pd(_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(e[0][r], zero, _CMP_GE_OQ), _mm256_cmp_pd(e[1][r], zero, _CMP_GE_OQ)), _mm256_cmp_pd(e[2][r], zero, _CMP_GE_OQ))) << 4*r;
+            int mask = valid & inside;                                   // coverage mask
+            if (mask) {
+                if (255==valid) {
+                    _mm256_store_pd(zb,   _mm256_cvtps_pd(_mm_loadu_ps(&zbuffer[x + y*width])));
+                    _mm256_store_pd(zb+4, _mm256_cvtps_pd(_mm_loadu_ps(&zbuffer[x + (y+1)*width])));
+                } else load_depth(zbuffer, x, y, 4, valid, width, zb);
+                int closer = 0;
+                for (int r : {0,1})
+                    closer |= _mm256_movemask_pd(_mm256_cmp_pd(z[r], _mm256_load_pd(zb+4*r), _CMP_GT_OQ)) << 4*r;
+                mask &= closer;                                          // depth test mask
+            }
+            if (mask) {
+                for (int r : {0,1}) {
+                    __m256d bc[3];
+                    for (int i : {0,1,2}) bc[i] = _mm256_mul_pd(e[i][r], iw[i]); // perspective-correct barycentric coordinates
+                    const __m256d sum = _mm256_add_pd(_mm256_add_pd(bc[0], bc[1]), bc[2]);
+                    for (int i : {0,1,2}) _mm256_store_pd(b[i]+4*r, _mm256_div_pd(bc[i], sum));
+                    _mm256_store_pd(depth+4*r, z[r]);
+                }
+                shade_lanes(ctx, t, x, y, 4, mask, depth, b[0], b[1], b[2], shader, framebuffer, vis);
+            }
+            for (int i : {0,1,2})
+                for (int r : {0,1})
+                    e[i][r] = _mm256_add_pd(e[i][r], step[i]);
+            for (int r : {0,1})
+                z[r] = _mm256_add_pd(z[r], zstep);
+        }
+    }
+}
+#endif
+
+template<class Shader> void rasterize_box(RasterState &ctx, const TriangleSetup &t, const int x0, const int y0, const int x1, const int y1, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+#if defined(SIMD_X86)
+    if (ctx.simd_level==SimdLevel::AVX2) return rasterize_box_avx2(ctx, t, x0, y0, x1, y1, shader, framebuffer, vis);
+    if (ctx.simd_level==SimdLevel::SSE2) return rasterize_box_sse2(ctx, t, x0, y0, x1, y1, shader, framebuffer, vis);
+#endif
+    rasterize_box_scalar(ctx, t, x0, y0, x1, y1, shader, framebuffer, vis);
+}
+
+template<class Shader, typename T> void rasterize(BasicRenderContext<T> &ctx, const BasicTriangle<T> &clip, const Shader &shader, TGAImage &framebuffer) {
+    TriangleSetup t[clip_max_triangles];
+    const int n = clip_triangle(ctx, clip, framebuffer.width(), framebuffer.height(), t);
+    for (int i=0; i<n; i++)
+        rasterize_box(ctx, t[i], t[i].xmin, t[i].ymin, t[i].xmax, t[i].ymax, shader, framebuffer, nullptr);
+}
+
+template<typename T> template<class Shader> void BasicBinnedRasterizer<T>::rasterize_tile(const int tile, const Shader &shader, TGAImage &framebuffer, VisibilityBuffer *vis) {
+    const int x0 = (tile % tiles_x) * tile_size, x1 = std::min(x0 + tile_size, width)  - 1;
+    const int y0 = (tile / tiles_x) * tile_size, y1 = std::min(y0 + tile_size, height) - 1;
+    for (int cy=y0/hiz_size; cy<=y1/hiz_size; cy++)
+        for (int cx=x0/hiz_size; cx<=x1/hiz_size; cx++)
+            hiz_dirty[cx + cy*cells_x] = 1;
+    for (const int index : bins[tile]) {
+        const TriangleSetup &t = triangles[index];
+        const int bx0 = std::max(x0, t.xmin), by0 = std::max(y0, t.ymin), bx1 = std::min(x1, t.xmax), by1 = std::min(y1, t.ymax);
+        if (!occlusion_culling) {
+            rasterize_box(*ctx, t, bx0, by0, bx1, by1, shader, framebuffer, vis);
+            continue;
+        }
+        for (int cy=by0/hiz_size; cy<=by1/hiz_size; cy++) { // per row of cells, rasterize the span between the first and the last cell not hiding the triangle
+            int first = -1, last = -1;
+            for (int cx=bx0/hiz_size; cx<=bx1/hiz_size; cx++) {
+                if (t.zmax <= cell_depth(cx, cy)) continue;
+                if (first<0) first = cx;
+                last = cx;
+            }
+            if (first<0) continue;                          // the whole row is occluded
+            rasterize_box(*ctx, t, std::max(bx0, first*hiz_size), std::max(by0, cy*hiz_size), std::min(bx1, last*hiz_size + hiz_size-1), std::min(by1, cy*hiz_size + hiz_size-1), shader, framebuffer, vis);
+            for (int cx=first; cx<=last; cx++)
+                hiz_dirty[cx + cy*cells_x] = 1;
+        }
+    }
+}
+
+template<typename T> template<class Shader> void BasicBinnedRasterizer<T>::flush(const Shader &shader, TGAImage &framebuffer, ThreadPool &pool) {
+    bin();
+    pool.parallel_for(bins.size(), [&](const int tile) { // a tile is owned by exactly one job: no locks on the framebuffer nor the z-buffer
+        rasterize_tile(tile, shader, framebuffer, nullptr);
+    });
+}
+
+template<typename T> template<class Shader> void BasicBinnedRasterizer<T>::flush_visibility(const Shader &shader, TGAImage &framebuffer, ThreadPool &pool) {
+    bin();
+    visibility.id.resize(width*height);
+    visibility.bar.resize(width*height);
+    pool.parallel_for(bins.size(), [&](const int tile) {
+        const int x0 = (tile % tiles_x) * tile_size, x1 = std::min(x0 + tile_size, width)  - 1;
+        const int y0 = (tile / tiles_x) * tile_size, y1 = std::min(y0 + tile_size, height) - 1;
+        for (int y=y0; y<=y1; y++)
+            std::fill(visibility.id.begin() + x0 + y*width, visibility.id.begin() + x1+1 + y*width, -1);
+        rasterize_tile(tile, shader, framebuffer, &visibility);         // pass 1: depth, triangle id and barycentric coordinates only
+        for (int y=y0; y<=y1; y++) {                                     // pass 2: every visible pixel is shaded exactly once,
+            int x = x0;                                                  // runs of pixels covered by the same triangle go in one batch
+            while (x<=x1) {
+                const int id = visibility.id[x+y*width];
+                int n = 1;
+                while (x+n<=x1 && n<8 && visibility.id[x+n+y*width]==id) n++;
+                if (id>=0) {
+                    TGAColor color[8];
+                    const int mask = shader.fragment_batch(id, n, &visibility.bar[x+y*width], (1<<n)-1, color);
+                    for (int i=0; i<n; i++)
+                        if (mask>>i & 1) framebuffer.set(x+i, y, color[i]); // N.B. a discarded fragment leaves the background, not what is behind it
+                }
+                x += n;
+            }
+        }
+    });
+}
@@ -0,0 +1,37 @@
+#pragma once
+#if defined(_M_X64) || defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2"))) // gcc/clang need it to emit AVX2 code in a function, msvc does not
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+inline SimdLevel simd_detect() { // best instruction set supported by both the CPU and the OS
+#if !defined(SIMD_X86)
+    return SimdLevel::SCALAR;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0]<7) return SimdLevel::SSE2;
+    __cpuid(info, 1);
+    const bool avx = (info[2] & (1<<28)) && (info[2] & (1<<27)) && (_xgetbv(0) & 6)==6; // AVX + OSXSAVE + YMM state enabled by the OS
+    __cpuidex(info, 7, 0);
+    return avx && (info[1] & (1<<5)) ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#endif
+}
+
+inline const char* simd_name(const SimdLevel level) {
+    return level==SimdLevel::AVX2 ? "avx2" : level==SimdLevel::SSE2 ? "sse2" : "scalar";
+}
@@ -0,0 +1,74 @@
+#include "texture.h"
+#include "simd.h"
+
+namespace {
+    // One row of n pixels of bpp bytes to packed b,g,r,a texels: grayscale replicated, missing alpha opaque
+    void expand_scalar(const std::uint8_t *src, std::uint32_t *dst, const int n, const int bpp, int x) {
+        for (; x<n; x++) {
+            const std::uint8_t *p = src + x*bpp;
+            const std::uint32_t b = p[0], g = bpp>1 ? p[1] : b, r = bpp>1 ? p[2] : b, a = bpp>3 ? p[3] : 255;
+            dst[x] = b | g<<8 | r<<16 | a<<24;
+        }
+    }
+
+#if defined(SIMD_X86)
+    void expand_gray_sse2(const std::uint8_t *src, std::uint32_t *dst, const int n) { // 16 texels per iteration
+        const __m128i opaque = _mm_set1_epi32(0xFF000000);
+        int x = 0;
+        for (; x+16<=n; x+=16) {
+            const __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+x));
+            const __m128i lo = _mm_unpacklo_epi8(v, v), hi = _mm_unpackhi_epi8(v, v); // gg
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+x   ), _mm_or_si128(_mm_unpacklo_epi16(lo, lo), opaque)); // gggg | ff000000
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+x+ 4), _mm_or_si128(_mm_unpackhi_epi16(lo, lo), opaque));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+x+ 8), _mm_or_si128(_mm_unpacklo_epi16(hi, hi), opaque));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+x+12), _mm_or_si128(_mm_unpackhi_epi16(hi, hi), opaque));
+        }
+        expand_scalar(src, dst, n, 1, x);
+    }
+
+    SIMD_TARGET_AVX2 void expand_bgr_avx2(const std::uint8_t *src, std::uint32_t *dst, const int n) { // 4 texels per shuffle
+        const __m128i opaque  = _mm_set1_epi32(0xFF000000);
+        const __m128i swizzle = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+        int x = 0;
+        for (; x+6<=n; x+=4) { // the 16 bytes load reads 4 bytes past the 4 texels, stay inside of the row
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+x*3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+x), _mm_or_si128(_mm_shuffle_epi8(v, swizzle), opaque));
+        }
+        expand_scalar(src, dst, n, 3, x);
+    }
+#endif
+
+    void expand(const std::uint8_t *src, std::uint32_t *dst, const int n, const int bpp) {
+        if (bpp==4) {
+            std::memcpy(dst, src, n*4);
+            return;
+        }
+#if defined(SIMD_X86)
+        static const SimdLevel level = simd_detect();
+        if (bpp==1) return expand_gray_sse2(src, dst, n);
+        if (level==SimdLevel::AVX2) return expand_bgr_avx2(src, dst, n);
+#endif
+        expand_scalar(src, dst, n, bpp, 0);
+    }
+}
+
+Texture::Texture(const TGAImage &img) {
+    if (!img.width() || !img.height()) return;
+    std::vector<std::uint32_t> row;
+    for (int l=0; l<img.mip_levels(); l++) {
+        const TGAImage &src = img.mip(l);
+        Level m;
+        m.w = src.width();
+        m.h = src.height();
+        m.tiles_x = (m.w + tile_mask) >> tile_bits;
+        m.texels.resize(m.tiles_x * ((m.h + tile_mask) >> tile_bits) << 2*tile_bits); // the border tiles are padded
+        row.resize(m.w);
+        const int bpp = src.bytespp();
+        for (int y=0; y<m.h; y++) {
+            expand(src.buffer() + std::size_t(y)*m.w*bpp, row.data(), m.w, bpp);
+            for (int x=0; x<m.w; x+=1<<tile_bits) // one tile row is contiguous
+                std::memcpy(&m.texels[index(m, x, y)], row.data()+x, std::min(1<<tile_bits, m.w-x)*4);
+        }
+        mips.push_back(std::move(m));
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "tgaimage.h"
+#include "geometry.h"
+
+// Read-only texture for the shaders. Texels are normalized to 32 bits in the TGAColor byte order (b,g,r,a),
+// grayscale is replicated to the three channels, missing alpha is opaque.
+// Every mip level is stored in 4x4 tiles: a tile is 64 bytes, i.e. one cache line, so a bilinear footprint
+// or a walk along any direction of the texture touches a handful of lines instead of one per row.
+class Texture {
+public:
+    static constexpr int tile_bits = 2;                   // 4x4 texels per tile
+    Texture() = default;
+    explicit Texture(const TGAImage &img);                // copies img and its mip chain, see TGAImage::generate_mipmaps()
+    int width(const int level=0)  const { return mips.empty() ? 0 : mips[level].w; }
+    int height(const int level=0) const { return mips.empty() ? 0 : mips[level].h; }
+    int levels() const { return mips.size(); }
+
+    std::uint32_t fetch(const int x, const int y, const int level=0) const { // packed texel, no bounds check
+        return mips[level].texels[index(mips[level], x, y)];
+    }
+
+    TGAColor get(const int x, const int y, const int level=0) const { // same contract as TGAImage::get(): black outside of the texture
+        if (mips.empty() || x<0 || y<0 || x>=width(level) || y>=height(level)) return {};
+        return unpack(fetch(x, y, level));
+    }
+
+    TGAColor sample(const vec2 &uv, const int level=0) const { // nearest texel
+        return get(uv.x*width(level), uv.y*height(level), level);
+    }
+
+    TGAColor sample(const vec2 &uv, const double lod, const bool trilinear) const { // lod: log2 of the texels per pixel, see lod()
+        if (mips.empty()) return {};
+        const double level = std::clamp(lod, 0., levels()-1.);
+        if (!trilinear) return sample(uv, int(std::lround(level)));
+        const int l0 = level, l1 = std::min(l0+1, levels()-1);
+        const TGAColor a = bilinear(uv, l0), b = bilinear(uv, l1);
+        TGAColor ret = a;
+        for (int i=4; i--; ret[i] = a[i] + (b[i]-a[i])*(level-l0) + .5);
+        return ret;
+    }
+
+    TGAColor bilinear(const vec2 &uv, const int level) const {
+        const int w = width(level), h = height(level);
+        const double x = std::clamp(uv.x*w -.5, 0., w-1.);    // texel centers are at half integers,
+        const double y = std::clamp(uv.y*h -.5, 0., h-1.);    // clamp to the border
+        const int x0 = x, y0 = y, x1 = std::min(x0+1, w-1), y1 = std::min(y0+1, h-1);
+        const double fx = x-x0, fy = y-y0;
+        const TGAColor c00 = unpack(fetch(x0, y0, level)), c10 = unpack(fetch(x1, y0, level));
+        const TGAColor c01 = unpack(fetch(x0, y1, level)), c11 = unpack(fetch(x1, y1, level));
+        TGAColor ret = c00;
+        for (int i=4; i--; )
+            ret[i] = (c00[i]*(1-fx) + c10[i]*fx)*(1-fy) + (c01[i]*(1-fx) + c11[i]*fx)*fy + .5;
+        return ret;
+    }
+
+    double lod(const vec2 uv[3], const vec2 screen[3]) const { // mip level for a triangle: texels per pixel from the ratio of its areas in the texture and on the screen
+        const vec2 t1 = uv[1]-uv[0], t2 = uv[2]-uv[0], s1 = screen[1]-screen[0], s2 = screen[2]-screen[0];
+        const double texels = std::abs(t1.x*t2.y - t1.y*t2.x) * width() * height();
+        const double pixels = std::abs(s1.x*s2.y - s1.y*s2.x);
+        return pixels>0 ? .5*std::log2(texels/pixels) : 0.;
+    }
+
+private:
+    static constexpr int tile_mask = (1<<tile_bits) - 1;
+    struct Level {
+        int w = 0, h = 0, tiles_x = 0;
+        std::vector<std::uint32_t> texels = {}; // tile after tile, row-major inside of a tile
+    };
+    static int index(const Level &m, const int x, const int y) { // tile (x/4, y/4), then texel (x%4, y%4) inside of the tile
+        return ((y>>tile_bits)*m.tiles_x + (x>>tile_bits)) << 2*tile_bits | (y & tile_mask) << tile_bits | (x & tile_mask);
+    }
+    static TGAColor unpack(const std::uint32_t texel) {
+        TGAColor ret;
+        std::memcpy(ret.bgra, &texel, 4);
+        return ret;
+    }
+    std::vector<Level> mips = {};
+};
@@ -1,104 +1,97 @@
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include "tgaimage.h"
+#include "mapped_file.h"
 
 TGAImage::TGAImage(const int w, const int h, const int bpp, TGAColor c) : w(w), h(h), bpp(bpp), data(w*h*bpp, 0) {
-    for (int j=0; j<h; j++)
-        for (int i=0; i<w; i++)
-            set(i, j, c);
+    fill(c);
 }
 
+// The whole file is mapped and decoded in one pass: rows are written straight to their final place,
+// the bottom-up orientation (the default of the format) costs nothing.
 bool TGAImage::read_tga_file(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
+    auto fail = [this](const char *message) { // the image is left empty, as if nothing had been read
+        std::cerr << message;
+        w = h = bpp = 0;
+        data.clear();
         return false;
+    };
+    MappedFile file(filename);
+    if (!file.data()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return fail("");
     }
     TGAHeader header;
-    in.read(reinterpret_cast<char *>(&header), sizeof(header));
-    if (!in.good()) {
-        std::cerr << "an error occured while reading the header\n";
-        return false;
-    }
+    if (file.size()<sizeof(header))
+        return fail("an error occured while reading the header\n");
+    std::memcpy(&header, file.data(), sizeof(header));
+    const int hbpp = header.bitsperpixel>>3;
+    if (header.width<=0 || header.height<=0 || (hbpp!=GRAYSCALE && hbpp!=RGB && hbpp!=RGBA))
+        return fail("bad bpp (or width/height) value\n");
     w   = header.width;
     h   = header.height;
-    bpp = header.bitsperpixel>>3;
-    if (w<=0 || h<=0 || (bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA)) {
-        std::cerr << "bad bpp (or width/height) value\n";
-        return false;
-    }
-    size_t nbytes = bpp*w*h;
-    data = std::vector<std::uint8_t>(nbytes, 0);
+    bpp = hbpp;
+    const std::uint8_t *begin = reinterpret_cast<const std::uint8_t*>(file.data()), *end = begin + file.size();
+    const std::size_t skip = sizeof(header) + header.idlength + (header.colormaptype ? header.colormaplength*((header.colormapdepth+7)>>3) : 0);
+    const std::uint8_t *pixels = begin + std::min(skip, file.size()); // image id and color map are ignored
+    const bool bottom_up = !(header.imagedescriptor & 0x20);
+    const std::size_t line = bpp*w;
+    data = std::vector<std::uint8_t>(line*h);
     if (3==header.datatypecode || 2==header.datatypecode) {
-        in.read(reinterpret_cast<char *>(data.data()), nbytes);
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
+        if (static_cast<std::size_t>(end-pixels)<line*h)
+            return fail("an error occured while reading the data\n");
+        for (int y=0; y<h; y++)
+            std::memcpy(data.data() + (bottom_up ? h-1-y : y)*line, pixels + y*line, line);
     } else if (10==header.datatypecode||11==header.datatypecode) {
-        if (!load_rle_data(in)) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
+        if (!load_rle_data(pixels, end, bottom_up))
+            return fail("an error occured while reading the data\n");
     } else {
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
-        return false;
+        return fail("");
     }
-    if (!(header.imagedescriptor & 0x20))
-        flip_vertically();
     if (header.imagedescriptor & 0x10)
         flip_horizontally();
     std::cerr << w << "x" << h << "/" << bpp*8 << "\n";
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    size_t pixelcount = w*h;
-    size_t currentpixel = 0;
-    size_t currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-        if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
-            }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+bool TGAImage::load_rle_data(const std::uint8_t *p, const std::uint8_t *end, const bool bottom_up) {
+    const std::size_t line = bpp*w;
+    std::size_t x = 0;                                  // byte offset in the current row
+    int y = 0;                                          // rows in file order
+    std::uint8_t *row = data.data() + (bottom_up ? h-1 : 0)*line;
+    while (y<h) {
+        if (p>=end) return false;
+        const bool run = *p & 128;                      // run-length packet: one pixel repeated, raw packet: count pixels
+        std::size_t count = (*p++ & 127) + 1;
+        if (static_cast<std::size_t>(end-p) < (run ? 1 : count)*bpp) return false;
+        const std::uint8_t *pixel = p;
+        if (!run) p += count*bpp;
+        while (count) {                                 // packets are not bound to the rows
+            const std::size_t n = std::min(count, (line-x)/bpp);
+            if (!run) {
+                std::memcpy(row+x, pixel, n*bpp);
+                pixel += n*bpp;
+            } else if (1==bpp) {
+                std::memset(row+x, *pixel, n);
+            } else {
+                for (std::size_t i=0; i<n; i++)
+                    std::memcpy(row+x+i*bpp, pixel, bpp);
             }
+            x += n*bpp;
+            count -= n;
+            if (x<line) continue;
+            x = 0;
+            if (++y==h) break;
+            row = data.data() + (bottom_up ? h-1-y : y)*line;
+        }
+        if (count) {
+            std::cerr << "Too many pixels read\n";
+            return false;
         }
-    } while (currentpixel < pixelcount);
+        if (run) p += bpp;
+    }
     return true;
 }
 
@@ -182,6 +175,13 @@ void TGAImage::set(int x, int y, const TGAColor &c) {
     memcpy(data.data()+(x+y*w)*bpp, c.bgra, bpp);
 }
 
+void TGAImage::fill(const TGAColor &c) {
+    if (!data.size()) return;
+    memcpy(data.data(), c.bgra, bpp);
+    for (size_t n=bpp; n<data.size(); n*=2)  // doubling copies of the filled prefix, memcpy does the vectorization
+        memcpy(data.data()+n, data.data(), std::min(n, data.size()-n));
+}
+
 void TGAImage::flip_horizontally() {
     for (int i=0; i<w/2; i++)
         for (int j=0; j<h; j++)
@@ -196,6 +196,14 @@ void TGAImage::flip_vertically() {
                 std::swap(data[(i+j*w)*bpp+b], data[(i+(h-1-j)*w)*bpp+b]);
 }
 
+int TGAImage::bytespp() const {
+    return bpp;
+}
+
+const std::uint8_t* TGAImage::buffer() const {
+    return data.data();
+}
+
 int TGAImage::width() const {
     return w;
 }
@@ -204,3 +212,27 @@ int TGAImage::height() const {
     return h;
 }
 
+void TGAImage::generate_mipmaps() {
+    mipmaps.clear();
+    const TGAImage *src = this;
+    while (src->w>1 || src->h>1) {
+        TGAImage dst(std::max(1, src->w/2), std::max(1, src->h/2), bpp);
+        for (int y=0; y<dst.h; y++)
+            for (int x=0; x<dst.w; x++)
+                for (int c=0; c<bpp; c++) {
+                    int sum = 0;
+                    for (int k=4; k--; sum += src->data[(std::min(2*x+k%2, src->w-1) + std::min(2*y+k/2, src->h-1)*src->w)*bpp + c]);
+                    dst.data[(x+y*dst.w)*bpp + c] = (sum+2)/4;
+                }
+        mipmaps.push_back(std::move(dst));
+        src = &mipmaps.back();
+    }
+}
+
+int TGAImage::mip_levels() const {
+    return 1 + mipmaps.size();
+}
+
+const TGAImage& TGAImage::mip(const int level) const {
+    return level ? mipmaps[level-1] : *this;
+}
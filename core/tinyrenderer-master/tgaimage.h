@@ -37,13 +37,20 @@ struct TGAImage {
     void flip_vertically();
     TGAColor get(const int x, const int y) const;
     void set(const int x, const int y, const TGAColor &c);
+    void fill(const TGAColor &c);               // every pixel set to c, cheaper than a set() loop
     int width()  const;
     int height() const;
+    int bytespp() const;
+    const std::uint8_t* buffer() const;         // raw pixels, row y at y*width()*bytespp(), channels in the TGAColor order
+    void generate_mipmaps();                    // 2x2 box filtered chain down to 1x1, to be regenerated after any modification of the image
+    int mip_levels() const;                     // 1 + number of mipmaps
+    const TGAImage& mip(const int level) const; // 0 <= level < mip_levels(), level 0 is the image itself
 private:
-    bool   load_rle_data(std::ifstream &in);
+    bool   load_rle_data(const std::uint8_t *p, const std::uint8_t *end, const bool bottom_up);
     bool unload_rle_data(std::ofstream &out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
     std::vector<std::uint8_t> data = {};
+    std::vector<TGAImage> mipmaps = {};
 };
 
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(const int nthreads) {
+    start(nthreads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(const int nthreads) {
+    const int n = nthreads>0 ? nthreads : std::max<int>(1, std::thread::hardware_concurrency());
+    if (n==size()) return;
+    stop();
+    start(n);
+}
+
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void ThreadPool::start(const int nthreads) {
+    const int n = nthreads>0 ? nthreads : std::max<int>(1, std::thread::hardware_concurrency());
+    quit = false;
+    for (int i=1; i<n; i++)
+        workers.emplace_back(&ThreadPool::worker, this);
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers) t.join();
+    workers.clear();
+}
+
+void ThreadPool::drain(std::unique_lock<std::mutex> &lock) { // grab jobs until none are left
+    while (next<njobs) {
+        const int job = next++;
+        lock.unlock();
+        call(task, job);
+        lock.lock();
+        if (++finished==njobs) done.notify_all();
+    }
+}
+
+void ThreadPool::worker() {
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&]() { return quit || seen!=generation; });
+        if (quit) return;
+        seen = generation;
+        busy++;
+        drain(lock);
+        if (!--busy) done.notify_all();
+    }
+}
+
+void ThreadPool::run(const int n, const Trampoline f, const void *job) {
+    if (n<=0) return;
+    if (workers.empty() || 1==n) {
+        for (int i=0; i<n; i++) f(job, i);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    call = f;
+    task = job;
+    njobs = n;
+    next = finished = 0;
+    generation++;
+    wake.notify_all();
+    drain(lock);
+    done.wait(lock, [&]() { return finished==njobs && !busy; }); // workers must let go of the job before it goes out of scope
+    call = nullptr;
+    task = nullptr;
+}
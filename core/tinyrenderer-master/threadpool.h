@@ -0,0 +1,33 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool { // persistent workers, the calling thread takes part in every parallel_for()
+public:
+    explicit ThreadPool(const int nthreads = 0); // 0 => one thread per hardware core
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    void resize(const int nthreads);             // total number of threads, including the caller
+    int size() const;
+    template<class Job> void parallel_for(const int n, const Job &job) { // job(0) ... job(n-1), returns when all are done
+        run(n, [](const void *f, const int i) { (*static_cast<const Job*>(f))(i); }, &job); // type-erased by hand, no std::function: nothing is allocated per call
+    }
+private:
+    typedef void (*Trampoline)(const void *job, const int i);
+    void run(const int n, const Trampoline call, const void *job);
+    void start(const int nthreads);
+    void stop();
+    void worker();
+    void drain(std::unique_lock<std::mutex> &lock);
+    std::vector<std::thread> workers = {};
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    Trampoline call = nullptr;                   // current job
+    const void *task = nullptr;
+    int njobs = 0, next = 0, finished = 0, busy = 0;
+    unsigned generation = 0;
+    bool quit = false;
+};
@@ -23,14 +23,22 @@ call :CheckAndCompile "core/console/console.cpp" "bin/console.obj"
 call :CheckAndCompile "core/clock/clock.cpp" "bin/clock.obj"
 call :CheckAndCompile "core/sound/sound.cpp" "bin/sound.obj"
 call :CheckAndCompile "core/render/render.cpp" "bin/render.obj"
+call :CheckAndCompile "core/render/scene.cpp" "bin/scene.obj"
+call :CheckAndCompile "core/render/ansi.cpp" "bin/ansi.obj"
+call :CheckAndCompile "core/render/palette.cpp" "bin/palette.obj"
+call :CheckAndCompile "core/render/dither.cpp" "bin/dither.obj"
+call :CheckAndCompile "core/loader/loader.cpp" "bin/loader.obj"
 call :CheckAndCompile "core/tinyrenderer-master/model.cpp" "bin/model.obj"
 call :CheckAndCompile "core/tinyrenderer-master/our_gl.cpp" "bin/our_gl.obj"
 call :CheckAndCompile "core/tinyrenderer-master/tgaimage.cpp" "bin/tgaimage.obj"
+call :CheckAndCompile "core/tinyrenderer-master/threadpool.cpp" "bin/threadpool.obj"
+call :CheckAndCompile "core/tinyrenderer-master/texture.cpp" "bin/texture.obj"
+call :CheckAndCompile "core/tinyrenderer-master/mapped_file.cpp" "bin/mapped_file.obj"
 
 echo Linking object files to create executable...
 
 REM Link all object files together
-link /OUT:engine.exe bin\main.obj bin\input.obj bin\window.obj bin\console.obj bin\clock.obj bin\sound.obj bin\render.obj bin\model.obj bin\our_gl.obj bin\tgaimage.obj /SUBSYSTEM:CONSOLE user32.lib kernel32.lib gdi32.lib winmm.lib
+link /OUT:engine.exe bin\main.obj bin\input.obj bin\window.obj bin\console.obj bin\clock.obj bin\sound.obj bin\render.obj bin\scene.obj bin\ansi.obj bin\palette.obj bin\dither.obj bin\loader.obj bin\model.obj bin\our_gl.obj bin\tgaimage.obj bin\threadpool.obj bin\texture.obj bin\mapped_file.obj /SUBSYSTEM:CONSOLE user32.lib kernel32.lib gdi32.lib winmm.lib
 
 echo Build complete!
 echo Hash information stored in compile_hashes.txt